@@ -1,5 +1,7 @@
 #include "clock.hpp"
 
+#include <algorithm>
+
 PluginClock::PluginClock() :
 	gate(false),
 	trigger(false),
@@ -7,46 +9,144 @@ PluginClock::PluginClock() :
 	phaseReset(false),
 	playing(false),
 	previousPlaying(false),
-	endOfBar(false),
+	resync(false),
+	ramping(false),
 	init(false),
+	period(1),
+	halfWavelength(0),
+	quarterWaveLength(0),
+	length(1),
 	pos(0),
+	stepCount(0),
+	periodRemainder(0),
+	periodDenominator(1),
+	carry(0),
+	stepsPerFrame(0.0),
+	stepsPerFrameSlope(0.0),
+	rampPhase(0.0),
+	rampPos(0),
+	swing(50.f),
+	groove(grooveTemplates[0]),
+	swingFrames(0),
+	grooveActive(false),
+	numPendingGates(0),
+	earlyStep(INT64_MIN),
+	gateStep(0),
+	running(true),
+	switchFrames(UINT32_MAX),
+	relocated(false),
+	jumpBeats(0.0),
+	hostFrame(0),
+	nextHostFrame(0),
+#ifdef CLOCK_INSTRUMENTATION
+	gateLog(nullptr),
+	logBlockStart(0),
+	logBlockFrames(0),
+	logBlockPos(0),
+	logBeats(0.0),
+	logBarBeat(0.0),
+	logBeatsPerFrame(0.0),
+	logOrigin(0.0),
+	logValid(false),
+	logOriginValid(false),
+	logSyncMode(-1),
+#endif
+	beatsPerBar(4),
 	bpm(120.0),
 	internalBpm(120.0),
+	hostBpm(120.0),
 	previousBpm(0),
+	previousHostBpm(120.0),
+	previousHostBpmSlope(0.0),
+	rampSlope(0.0),
 	sampleRate(48000.0),
+	division(0),
+	blockFrames(0),
 	previousSyncMode(0),
-	barLength(4),
-	previousBeat(0)
+	hostBar(1),
+	hostBeat(1),
+	hostBeatFraction(0.0),
+	barLength(4)
 {
 	//TODO everything initialized?
+	calcGroove();
 }
 
 PluginClock::~PluginClock()
 {
 }
 
-void PluginClock::transmitHostInfo(const bool playing, const float beatsPerBar,
-		const int hostBeat, const float hostBarBeat, const float hostBpm)
+// the position within the beat. The whole ticks can be several frames
+// apart, so the float barBeat is used where the host fills it in on the
+// same beat and tick.
+static double getBeatFraction(const TimePosition& position)
 {
-	this->beatsPerBar = beatsPerBar;
-	this->hostBeat = hostBeat;
-	this->hostBarBeat = hostBarBeat;
-	this->hostBpm = hostBpm;
-	this->playing = playing;
+	const double tickBeats = (position.bbt.ticksPerBeat > 0.0) ? 1.0 / position.bbt.ticksPerBeat : 0.0;
+	const double ticks = position.bbt.tick * tickBeats;
+	const double fraction = position.bbt.barBeat - (position.bbt.beat - 1);
 
-	if (playing && !previousPlaying && beatSync) {
-		syncClock();
+	if (fraction >= 0.0 && fraction < 1.0 && fabs(fraction - ticks) <= std::max(tickBeats, 1e-6)) {
+		return fraction;
 	}
-	if (playing != previousPlaying) {
-		previousPlaying = playing;
+
+	return ticks;
+}
+
+void PluginClock::transmitHostInfo(const TimePosition& position)
+{
+	playing = position.playing && position.bbt.valid;
+	jumpBeats = 0.0;
+
+	// where the host should be after the last block, a loop or a seek lands
+	// somewhere else
+	if (playing && previousPlaying) {
+		jumpBeats = getHostJump(position);
+	}
+	relocated = fabs(jumpBeats) > CLOCK_JUMP_TOLERANCE;
+
+	if (position.bbt.valid) {
+		hostBar = position.bbt.bar;
+		hostBeat = position.bbt.beat;
+		hostBeatFraction = getBeatFraction(position);
+#ifdef CLOCK_INSTRUMENTATION
+		logBarBeat = position.bbt.barBeat;
+#endif
+		beatsPerBar = position.bbt.beatsPerBar;
+		hostBpm = static_cast<float>(position.bbt.beatsPerMinute);
 	}
 
+	// the host frame only jumps on a seek or a loop, as long as it runs on
+	// from the previous block the clock can keep its own phase
+	if (playing && (!previousPlaying || position.frame != nextHostFrame || relocated)) {
+		resync = true;
+	}
+	hostFrame = position.frame;
+	previousPlaying = playing;
+
 	if (!init) {
 		calcPeriod();
 		init = true;
 	}
 }
 
+// beats between the position the host reports and where it would be had it
+// played on through the last block at its tempo
+double PluginClock::getHostJump(const TimePosition& position) const
+{
+	double barBeat = hostBeat - 1 + hostBeatFraction + hostBpm * blockFrames / (60.0 * sampleRate);
+
+	const double bars = floor(barBeat / beatsPerBar);
+	barBeat -= bars * beatsPerBar;
+
+	return (position.bbt.bar - hostBar - bars) * beatsPerBar
+			+ (position.bbt.beat - 1 + getBeatFraction(position) - barBeat);
+}
+
+void PluginClock::receiveMidiClock(const MidiEvent& event)
+{
+	midiClock.process(event);
+}
+
 void PluginClock::setSyncMode(int mode)
 {
 	switch (mode)
@@ -60,6 +160,9 @@ void PluginClock::setSyncMode(int mode)
 		case HOST_QUANTIZED_SYNC:
 			beatSync = true;
 			break;
+		case MIDI_CLOCK_SYNC:
+			beatSync = false;
+			break;
 	}
 
 	this->syncMode = mode;
@@ -70,47 +173,363 @@ void PluginClock::setInternalBpmValue(float internalBpm)
 	this->internalBpm = internalBpm;
 }
 
-void PluginClock::setBpm(float bpm)
+// a new tempo keeps the phase of the step that is playing, and a ramp is
+// followed frame by frame until the step ends
+void PluginClock::setBpm(float bpm, double bpmSlope, double phaseOffset)
 {
+	const double phase = std::min(std::max(getPhase() + phaseOffset, 0.0), 1.0);
+
 	this->bpm = bpm;
 	calcPeriod();
+
+	if (bpmSlope != 0.0) {
+		setRamp(phase, bpmSlope);
+	} else {
+		setPhase(phase);
+	}
+}
+
+// how far the clock is into the step, 0 at its start and 1 at its end
+double PluginClock::getPhase() const
+{
+	if (ramping) {
+		const double frames = static_cast<double>(pos) - rampPos;
+		return rampPhase + frames * (stepsPerFrame + 0.5 * stepsPerFrameSlope * frames);
+	}
+
+	return (static_cast<double>(pos) * periodDenominator - carry) / (static_cast<double>(period) * periodDenominator + periodRemainder);
+}
+
+// moves the start of the step so the clock is at phase at the current tempo
+void PluginClock::setPhase(double phase)
+{
+	const double elapsed = phase * (period + static_cast<double>(periodRemainder) / periodDenominator);
+
+	// a step that only misses a whole frame by rounding is taken as on it,
+	// here and in getRampFrames()
+	pos = static_cast<uint32_t>(ceil(elapsed - 1e-4));
+	const double fraction = (pos - elapsed) * periodDenominator;
+	carry = (fraction > 0.0) ? static_cast<uint64_t>(fraction + 0.5) : 0;
+	carry = (carry < periodDenominator) ? carry : periodDenominator - 1;
+	calcLength();
+}
+
+// how much of a step one frame at the given tempo is
+double PluginClock::getStepsPerFrame(double bpm) const
+{
+	return bpm * divisions[division].numerator / (sampleRate * 120.0 * divisions[division].denominator);
+}
+
+void PluginClock::setRamp(double phase, double bpmSlope)
+{
+	stepsPerFrame = getStepsPerFrame(bpm);
+	stepsPerFrameSlope = getStepsPerFrame(bpmSlope);
+	rampPhase = phase;
+	rampPos = pos;
+	ramping = true;
+	length = pos + getRampFrames(phase);
+}
+
+// frames until the step ends while ramping, solved from
+// phase + stepsPerFrame * t + stepsPerFrameSlope * t^2 / 2 = 1
+uint32_t PluginClock::getRampFrames(double phase) const
+{
+	const double remaining = 1.0 - phase;
+	const double discriminant = stepsPerFrame * stepsPerFrame + 2.0 * stepsPerFrameSlope * remaining;
+	const uint32_t maxFrames = UINT32_MAX / 2;
+
+	if (remaining <= 0.0) {
+		return 0;
+	}
+	// the tempo would stop before the step ends
+	if (discriminant < 0.0 || stepsPerFrame + sqrt(discriminant) <= 0.0) {
+		return maxFrames;
+	}
+
+	const double frames = 2.0 * remaining / (stepsPerFrame + sqrt(discriminant));
+
+	return (frames < maxFrames) ? static_cast<uint32_t>(frames + 1e-4) : maxFrames;
 }
 
 void PluginClock::setSampleRate(float sampleRate)
 {
 	this->sampleRate = sampleRate;
+	midiClock.setSampleRate(sampleRate);
 	calcPeriod();
 }
 
 void PluginClock::setDivision(int setDivision)
 {
-	this->division = setDivision;
-	this->divisionValue = divisionValues[setDivision];
+	this->division = std::min(std::max(setDivision, 0), NUM_DIVISIONS - 1);
+#ifdef CLOCK_INSTRUMENTATION
+	logOriginValid = false;
+#endif
 
 	calcPeriod();
+	resync = true;
+}
+
+// swing in percent of a pair of steps the first one takes, 50 is straight
+void PluginClock::setSwing(float swing)
+{
+	this->swing = std::min(std::max(swing, 50.f), 75.f);
+	calcGroove();
+}
+
+void PluginClock::setGroove(const GrooveTemplate& groove)
+{
+	this->groove = groove;
+	this->groove.numSteps = std::min(std::max(groove.numSteps, static_cast<unsigned>(GROOVE_MIN_STEPS)), static_cast<unsigned>(GROOVE_MAX_STEPS));
+	calcGroove();
+}
+
+void PluginClock::calcGroove()
+{
+	const double exactPeriod = period + static_cast<double>(periodRemainder) / periodDenominator;
+
+	swingFrames = static_cast<int32_t>(lround((swing - 50.0) / 50.0 * exactPeriod));
+	grooveActive = swingFrames != 0;
+
+	for (unsigned i = 0; i < groove.numSteps; i++) {
+		grooveFrames[i] = static_cast<int32_t>(lround((groove.offsets[i] - groove.offsets[0]) * exactPeriod));
+		grooveActive = grooveActive || grooveFrames[i] != 0;
+	}
+}
+
+// how far the gate of a step is off the grid, at most half a step either way
+int32_t PluginClock::getGrooveFrames(int64_t step) const
+{
+	const int64_t index = step % groove.numSteps;
+	const int32_t maxFrames = static_cast<int32_t>(halfWavelength);
+	const int32_t frames = grooveFrames[(index < 0) ? index + groove.numSteps : index] + ((step & 1) ? swingFrames : 0);
+
+	return std::min(std::max(frames, -maxFrames), maxFrames);
+}
+
+float PluginClock::getGateScale() const
+{
+	const int64_t index = gateStep % groove.numSteps;
+
+	return groove.gates[(index < 0) ? index + groove.numSteps : index];
+}
+
+// the grid reached the step, its gate opens now or once its offset passed,
+// and the next step's gate is set up if it comes before the next step
+void PluginClock::openGate()
+{
+	if (!grooveActive) {
+		gate = true;
+		gateStep = stepCount;
+		return;
+	}
+
+	const int32_t frames = getGrooveFrames(stepCount);
+	if (frames > 0) {
+		addPendingGate(static_cast<uint32_t>(frames), stepCount);
+	} else if (earlyStep != stepCount) {
+		gate = true;
+		gateStep = stepCount;
+	}
+
+	const int32_t nextFrames = getGrooveFrames(stepCount + 1);
+	if (nextFrames < 0) {
+		addPendingGate(length - pos + nextFrames, stepCount + 1);
+		earlyStep = stepCount + 1;
+	}
+}
+
+void PluginClock::addPendingGate(uint32_t frames, int64_t step)
+{
+	if (numPendingGates < 2) {
+		pendingFrames[numPendingGates] = frames - 1;
+		pendingSteps[numPendingGates] = step;
+		numPendingGates++;
+	}
+}
+
+void PluginClock::clearPendingGates()
+{
+	numPendingGates = 0;
+	earlyStep = INT64_MIN;
 }
 
 void PluginClock::syncClock()
 {
-    pos = static_cast<uint32_t>(fmod(sampleRate * (60.0f / bpm) * (hostBarBeat + (numBarsElapsed * beatsPerBar)), sampleRate * (60.0f / (bpm * (divisionValue / 2.0f)))));
+	clearPendingGates();
+
+	// the part of a frame the host is into the step is kept as carry, so the
+	// step ends on the frame the host crosses into the next one
+	const double frames = getHostPos(stepCount);
+	pos = static_cast<uint32_t>(ceil(frames));
+	carry = std::min(static_cast<uint64_t>((pos - frames) * periodDenominator), periodDenominator - 1);
+	calcLength();
+}
+
+// where in the step the host position falls, and how many steps came before
+// it. Whole beats are counted in integers, so the result does not lose
+// precision the longer a song gets.
+double PluginClock::getHostPos(int64_t& steps) const
+{
+	// one step is 2 * denominator / numerator beats, count in 1/numerator beats
+	const int64_t numerator = divisions[division].numerator;
+	const int64_t stepUnits = 2 * divisions[division].denominator;
+
+	const double barBeats = static_cast<double>(hostBar - 1) * beatsPerBar;
+	const int64_t wholeBeats = static_cast<int64_t>(floor(barBeats)) + hostBeat - 1;
+	const double fraction = barBeats - floor(barBeats) + hostBeatFraction;
+
+	int64_t units = (wholeBeats * numerator) % stepUnits;
+	if (units < 0) {
+		units += stepUnits;
+	}
+	const double phase = fmod(units + fraction * numerator, static_cast<double>(stepUnits));
+	steps = (wholeBeats * numerator - units) / stepUnits + static_cast<int64_t>(floor((units + fraction * numerator) / stepUnits));
+
+	return phase * sampleRate * 60.0 / (bpm * numerator);
+}
+
+// where in the step a song position in MIDI clock ticks falls, counted the
+// same way as getHostPos()
+double PluginClock::getTickPhase(double ticks) const
+{
+	const int64_t numerator = divisions[division].numerator;
+	const int64_t stepUnits = 2 * MIDI_CLOCK_PPQN * divisions[division].denominator;
+	const double wholeTicks = floor(ticks);
+
+	int64_t units = (static_cast<int64_t>(wholeTicks) * numerator) % stepUnits;
+	if (units < 0) {
+		units += stepUnits;
+	}
+
+	return fmod(units + (ticks - wholeTicks) * numerator, static_cast<double>(stepUnits)) / stepUnits;
 }
 
+// the clock runs and stops with the external one, and starts on the phase
+// of the song position on the tick it starts on
+void PluginClock::followMidiClock()
+{
+	running = midiClock.wasRunning();
+	switchFrames = midiClock.getSwitchFrame();
+
+	if (switchFrames != UINT32_MAX && midiClock.isRunning()) {
+		clearPendingGates();
+		const int64_t startTicks = midiClock.getStartTicks();
+		stepCount = startTicks * divisions[division].numerator / (2 * MIDI_CLOCK_PPQN * divisions[division].denominator);
+		setPhase(getTickPhase(static_cast<double>(startTicks)));
+		trigger = false;
+	}
+}
+
+// starts the steps over from the beginning of the song
 void PluginClock::setPos(uint32_t pos)
 {
 	this->pos = pos;
+	stepCount = 0;
+#ifdef CLOCK_INSTRUMENTATION
+	logOriginValid = false;
+#endif
+	clearPendingGates();
+	carry = 0;
+	calcLength();
 }
 
-void PluginClock::setNumBarsElapsed(uint32_t numBarsElapsed)
+// exact mantissa and exponent of a float, value = mantissa * 2^exponent
+static void splitFloat(float value, uint64_t& mantissa, int& exponent)
 {
-	this->numBarsElapsed = numBarsElapsed;
+	mantissa = static_cast<uint64_t>(ldexpf(frexpf(value, &exponent), 24));
+	exponent -= 24;
+
+	while (mantissa != 0 && (mantissa & 1) == 0) {
+		mantissa >>= 1;
+		exponent++;
+	}
 }
 
+// frames per step = sampleRate * 120 / (bpm * division), worked out as
+// a ratio of integers instead of being truncated to whole frames
 void PluginClock::calcPeriod()
 {
-	period = static_cast<uint32_t>(sampleRate * (60.0f / (bpm * (divisionValue / 2.0f))));
-	halfWavelength = static_cast<uint32_t>(period / 2.0f);
-	quarterWaveLength = static_cast<uint32_t>(halfWavelength / 2.0f);
-	period = (period <= 0) ? 1 : period;
+	uint64_t numerator, denominator;
+	int numeratorExponent, denominatorExponent;
+
+	splitFloat(sampleRate, numerator, numeratorExponent);
+	splitFloat(bpm, denominator, denominatorExponent);
+	numerator *= 120 * divisions[division].denominator;
+	denominator *= divisions[division].numerator;
+
+	// only absurd sample rates or tempos come close to overflowing here
+	const uint64_t limit = UINT64_C(1) << 62;
+	for (int shift = numeratorExponent - denominatorExponent; shift > 0; shift--) {
+		if (numerator < limit) {
+			numerator <<= 1;
+		} else {
+			denominator >>= 1;
+		}
+	}
+	for (int shift = numeratorExponent - denominatorExponent; shift < 0; shift++) {
+		if (denominator < limit) {
+			denominator <<= 1;
+		} else {
+			numerator >>= 1;
+		}
+	}
+
+	if (numerator == 0 || denominator == 0 || numerator / denominator == 0) {
+		numerator = 1;
+		denominator = 1;
+	}
+
+	// a fine denominator, so a phase carried over from a tempo ramp fits too
+	while (denominator < (UINT64_C(1) << 32) && numerator < limit) {
+		numerator <<= 1;
+		denominator <<= 1;
+	}
+
+	// keep the phase of the carried fraction when the ratio changes
+	if (denominator != periodDenominator) {
+		carry = static_cast<uint64_t>(static_cast<double>(carry) / periodDenominator * denominator);
+		carry = (carry < denominator) ? carry : denominator - 1;
+	}
+
+	period = static_cast<uint32_t>(numerator / denominator);
+	periodRemainder = numerator % denominator;
+	periodDenominator = denominator;
+	halfWavelength = period / 2;
+	quarterWaveLength = halfWavelength / 2;
+
+	calcLength();
+	calcGroove();
+}
+
+// the step that starts now is one frame longer when the carry overflows
+void PluginClock::calcLength()
+{
+	length = period + ((carry + periodRemainder >= periodDenominator) ? 1 : 0);
+	ramping = false;
+}
+
+void PluginClock::nextCycle()
+{
+	stepCount++;
+
+	if (ramping) {
+		// the new step starts where the ramp crossed the end of the last
+		// one, the part of a frame in between is carried over as phase
+		const double frames = static_cast<double>(length) - rampPos;
+		rampPhase += frames * (stepsPerFrame + 0.5 * stepsPerFrameSlope * frames) - 1.0;
+		stepsPerFrame += stepsPerFrameSlope * frames;
+		rampPos = 0;
+		pos = 0;
+		length = getRampFrames(rampPhase);
+		return;
+	}
+
+	pos = 0;
+	carry += periodRemainder;
+	if (carry >= periodDenominator) {
+		carry -= periodDenominator;
+	}
+	calcLength();
 }
 
 void PluginClock::closeGate()
@@ -153,77 +572,382 @@ uint32_t PluginClock::getPeriod() const
 	return period;
 }
 
+void PluginClock::getPeriodRatio(uint64_t& numerator, uint64_t& denominator) const
+{
+	numerator = period * periodDenominator + periodRemainder;
+	denominator = periodDenominator;
+}
+
 uint32_t PluginClock::getPos() const
 {
 	return pos;
 }
 
-void PluginClock::tick()
+// host position, tempo and sync mode only change between blocks, frames is
+// the length of the block that starts now
+void PluginClock::update(uint32_t frames)
 {
-	int beat = static_cast<int>(hostBarBeat);
+	nextHostFrame = hostFrame + frames;
+
+	// a host tempo that moved the same way over the last two blocks is
+	// taken as a ramp, and carried on through this block
+	double bpmSlope = 0.0;
+	double phaseOffset = 0.0;
 
-	if (beatsPerBar <= 1) {
-		if (hostBarBeat > 0.99 && !endOfBar) {
-			endOfBar = true;
+	if (playing && !resync && blockFrames > 0) {
+		const double slope = (hostBpm - previousHostBpm) / blockFrames;
+
+		// between two host positions the tempo is taken to move in a straight
+		// line, which adds to the phase on top of the tempo the last block ran at
+		phaseOffset = 0.5 * getStepsPerFrame(slope - rampSlope) * blockFrames * blockFrames;
+
+		if (slope * previousHostBpmSlope > 0.0) {
+			bpmSlope = (fabs(slope) < fabs(previousHostBpmSlope)) ? slope : previousHostBpmSlope;
 		}
-		else if (hostBarBeat < 0.1 && endOfBar) {
-			numBarsElapsed++;
-			endOfBar = false;
+		previousHostBpmSlope = slope;
+	} else {
+		previousHostBpmSlope = 0.0;
+	}
+	previousHostBpm = hostBpm;
+	blockFrames = frames;
+
+	float newBpm = hostBpm;
+	if (syncMode == FREE_RUNNING) {
+		newBpm = internalBpm;
+		bpmSlope = 0.0;
+		phaseOffset = 0.0;
+	} else if (syncMode == MIDI_CLOCK_SYNC) {
+		newBpm = midiClock.hasTempo() ? midiClock.getBpm() : internalBpm;
+		bpmSlope = 0.0;
+		phaseOffset = 0.0;
+
+		// pulled onto the phase of the ticks, by at most half a step either way
+		if (midiClock.wasRunning() && midiClock.isLocked(0)) {
+			const double offset = getTickPhase(midiClock.getTicks(0)) - getPhase();
+			phaseOffset = offset - floor(offset + 0.5);
 		}
+	}
+	rampSlope = bpmSlope;
+
+	if (newBpm != previousBpm || bpmSlope != 0.0 || ramping || phaseOffset != 0.0 || syncMode != previousSyncMode) {
+		if (syncMode != previousSyncMode) {
+			resync = true;
+		}
+		setBpm(newBpm, bpmSlope, phaseOffset);
+		previousBpm = newBpm;
+		previousSyncMode = syncMode;
+	}
+
+	// in between the phase runs on by itself
+	if (playing && beatSync && resync) {
+		syncClock();
+	}
+	resync = false;
+
+	if (syncMode == MIDI_CLOCK_SYNC) {
+		followMidiClock();
 	} else {
-		if (beat != previousBeat) {
-			numBarsElapsed = (beat == 0) ? numBarsElapsed + 1 : numBarsElapsed;
-			previousBeat = beat;
+		running = true;
+		switchFrames = UINT32_MAX;
+	}
+#ifdef CLOCK_INSTRUMENTATION
+	updateLog(frames);
+#endif
+	midiClock.nextBlock(frames);
+}
+
+// the host looped or was moved to another position at the start of the block
+bool PluginClock::wasRelocated() const
+{
+	return relocated;
+}
+
+// how far the host moved away from where it was expected, back is negative
+double PluginClock::getJumpBeats() const
+{
+	return jumpBeats;
+}
+
+// the host transport, or the external clock's with MIDI clock sync
+bool PluginClock::isPlaying() const
+{
+	if (syncMode == MIDI_CLOCK_SYNC) {
+		return running || switchFrames != UINT32_MAX;
+	}
+
+	return playing;
+}
+
+bool PluginClock::isRunning() const
+{
+	return running;
+}
+
+// frames into the block at which the clock starts or stops running
+uint32_t PluginClock::getSwitchFrames() const
+{
+	return switchFrames;
+}
+
+double PluginClock::getTicksPerStep() const
+{
+	return 2.0 * MIDI_CLOCK_PPQN * divisions[division].denominator / divisions[division].numerator;
+}
+
+// the position of the step grid in MIDI clock ticks, the steps since the
+// song position was set plus how far the clock is into this one
+double PluginClock::getSongTicks() const
+{
+	return (stepCount + getPhase()) * getTicksPerStep();
+}
+
+double PluginClock::getTicksPerFrame() const
+{
+	if (ramping) {
+		return (stepsPerFrame + stepsPerFrameSlope * (static_cast<double>(pos) - rampPos)) * getTicksPerStep();
+	}
+
+	return getTicksPerStep() * periodDenominator / (static_cast<double>(period) * periodDenominator + periodRemainder);
+}
+
+double PluginClock::getTicksPerFrameSlope() const
+{
+	return ramping ? stepsPerFrameSlope * getTicksPerStep() : 0.0;
+}
+
+// number of ticks that pass before the one that opens the gate
+uint32_t PluginClock::getFramesUntilGate() const
+{
+	if (!running) {
+		if (switchFrames == UINT32_MAX) {
+			return UINT32_MAX;
 		}
+		uint32_t frames = getRunningFramesUntilGate();
+		for (unsigned i = 0; i < numPendingGates; i++) {
+			frames = std::min(frames, pendingFrames[i]);
+		}
+		return switchFrames + std::min(frames, UINT32_MAX - switchFrames);
+	}
+
+	uint32_t frames = getRunningFramesUntilGate();
+	for (unsigned i = 0; i < numPendingGates; i++) {
+		frames = std::min(frames, pendingFrames[i]);
 	}
 
-	float threshold = 0.009; //TODO might not be needed
+	// the clock stops before it gets there
+	return (frames < switchFrames) ? frames : UINT32_MAX;
+}
 
-	switch (syncMode)
-	{
-		case FREE_RUNNING:
-			if ((internalBpm != previousBpm) || (syncMode != previousSyncMode)) {
-				setBpm(internalBpm);
-				previousBpm = internalBpm;
-				previousSyncMode = syncMode;
-			}
-			break;
-		case HOST_BPM_SYNC:
-			if ((hostBpm != previousBpm && (fabs(previousBpm - hostBpm) > threshold)) || (syncMode != previousSyncMode)) {
-				setBpm(hostBpm);
-				previousBpm = hostBpm;
-				previousSyncMode = syncMode;
-			}
-			break;
-		case HOST_QUANTIZED_SYNC: //TODO fix this duplicate
-			if ((hostBpm != previousBpm && (fabs(previousBpm - hostBpm) > threshold)) || (syncMode != previousSyncMode)) {
-				setBpm(hostBpm);
-				if (playing) {
-					syncClock();
-				}
-				previousBpm = hostBpm;
-				previousSyncMode = syncMode;
-			}
-			break;
+uint32_t PluginClock::getRunningFramesUntilGate() const
+{
+	if (quarterWaveLength == 0) {
+		return UINT32_MAX;
 	}
 
-	if (pos > period) {
-		pos = 0;
+	uint32_t p = (pos >= length) ? 0 : pos;
+	uint32_t frames = 0;
+
+	if (trigger) {
+		// the trigger is re-armed on the first tick past half a period
+		if (p <= halfWavelength) {
+			frames += halfWavelength + 1 - p;
+			p = halfWavelength + 1;
+		}
+		frames++;
+		p++;
+	}
+
+	if (p >= length || p < quarterWaveLength) {
+		return frames;
+	}
+
+	return frames + length - p;
+}
+
+// same as calling tick() for the given number of frames, as long as the
+// gate does not open in between
+void PluginClock::advance(uint32_t frames)
+{
+#ifdef CLOCK_INSTRUMENTATION
+	logBlockPos += frames;
+#endif
+	if (switchFrames < frames) {
+		if (running) {
+			run(switchFrames);
+		}
+		frames -= switchFrames;
+		running = !running;
+		switchFrames = UINT32_MAX;
+	} else if (switchFrames != UINT32_MAX) {
+		switchFrames -= frames;
+	}
+
+	if (running) {
+		run(frames);
+	}
+}
+
+void PluginClock::run(uint32_t frames)
+{
+	if (frames == 0) {
+		return;
+	}
+
+	for (unsigned i = 0; i < numPendingGates; i++) {
+		pendingFrames[i] -= frames;
+	}
+
+	if (pos >= length) {
+		nextCycle();
+	}
+	if (trigger && pos + frames - 1 > halfWavelength) {
+		trigger = false;
+	}
+
+	pos += frames;
+}
+
+// same as calling tick() for the given number of frames and closing every
+// gate that opens, it goes from one gate to the next instead of frame by frame
+void PluginClock::skip(uint32_t frames)
+{
+	while (frames > 0) {
+		const uint32_t idleFrames = std::min(frames, getFramesUntilGate());
+		advance(idleFrames);
+		frames -= idleFrames;
+
+		if (frames > 0) {
+			tick();
+			closeGate();
+			frames--;
+		}
+	}
+}
+
+void PluginClock::tick()
+{
+#ifdef CLOCK_INSTRUMENTATION
+	const uint32_t logFrame = logBlockPos++;
+#endif
+	if (switchFrames != UINT32_MAX) {
+		if (switchFrames == 0) {
+			running = !running;
+		}
+		switchFrames--;
+	}
+	if (!running) {
+		return;
+	}
+
+	unsigned i = 0;
+	while (i < numPendingGates) {
+		if (pendingFrames[i] == 0) {
+			gate = true;
+			gateStep = pendingSteps[i];
+			numPendingGates--;
+			pendingFrames[i] = pendingFrames[numPendingGates];
+			pendingSteps[i] = pendingSteps[numPendingGates];
+		} else {
+			pendingFrames[i]--;
+			i++;
+		}
+	}
+
+	if (pos >= length) {
+		nextCycle();
 	}
 
 	if (pos < quarterWaveLength && !trigger) {
-		gate = true;
 		trigger = true;
+#ifdef CLOCK_INSTRUMENTATION
+		logGate(logFrame);
+#endif
+		openGate();
 	} else if (pos > halfWavelength && trigger) {
-		if (playing && beatSync) {
-			syncClock();
-		}
 		trigger = false;
 	}
 
-	if (playing && beatSync) {
-		syncClock(); //hard-sync to host position
+	pos++;
+}
+
+#ifdef CLOCK_INSTRUMENTATION
+void PluginClock::setGateLog(GateLog* gateLog)
+{
+	this->gateLog = gateLog;
+}
+
+// frames the clock stood still for, the log keeps counting them
+void PluginClock::logHeldFrames(uint32_t frames)
+{
+	logBlockPos += frames;
+}
+
+// where the timeline is at the start of the block that starts now
+void PluginClock::updateLog(uint32_t frames)
+{
+	if (syncMode != logSyncMode) {
+		logSyncMode = syncMode;
+		logOriginValid = false;
+	}
+
+	if (syncMode == HOST_QUANTIZED_SYNC) {
+		// the fractional beat, the host ticks are whole numbers and can be
+		// several frames apart
+		logValid = playing;
+		logBeats = static_cast<double>(hostBar - 1) * beatsPerBar + logBarBeat;
+		logBeatsPerFrame = hostBpm / (60.0 * sampleRate);
+	} else if (syncMode == MIDI_CLOCK_SYNC) {
+		logValid = midiClock.hasTempo() && midiClock.isLocked(0);
+		if (logValid) {
+			logBeats = midiClock.getTicks(0) / MIDI_CLOCK_PPQN;
+			logBeatsPerFrame = midiClock.getBpm() / (60.0 * sampleRate);
+		}
+	} else {
+		logValid = true;
+		logBeats += logBeatsPerFrame * logBlockFrames;
+		logBeatsPerFrame = bpm / (60.0 * sampleRate);
+	}
+
+	logBlockStart += logBlockFrames;
+	logBlockFrames = frames;
+	logBlockPos = 0;
+}
+
+// late gates have a positive error, in frames. Synced to a host or an
+// external clock that is against the nearest step of its timeline, else
+// against the grid the first step started. While the clock is held for the
+// first note that step is opened on every frame, so it is not logged.
+void PluginClock::logGate(uint32_t frame)
+{
+	if (gateLog == nullptr || !logValid || logBeatsPerFrame <= 0.0) {
+		return;
+	}
+
+	const double stepBeats = 2.0 * divisions[division].denominator / divisions[division].numerator;
+	const double beats = logBeats + frame * logBeatsPerFrame;
+	double steps;
+
+	if (syncMode == HOST_QUANTIZED_SYNC || syncMode == MIDI_CLOCK_SYNC) {
+		steps = beats / stepBeats;
+		steps -= floor(steps + 0.5);
 	} else {
-		pos++;
+		if (!logOriginValid || stepCount == 0) {
+			logOrigin = beats - stepCount * stepBeats;
+			logOriginValid = true;
+			if (stepCount == 0) {
+				return;
+			}
+		}
+		steps = (beats - logOrigin) / stepBeats - stepCount;
 	}
+
+	GateRecord record;
+	record.frame = logBlockStart + frame;
+	record.step = stepCount;
+	record.error = steps * stepBeats / logBeatsPerFrame;
+	record.syncMode = syncMode;
+	record.division = division;
+
+	gateLog->push(record);
 }
+#endif
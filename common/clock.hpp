@@ -1,42 +1,97 @@
 #ifndef _H_CLOCK_
 #define _H_CLOCK_
 
+#include "DistrhoPlugin.hpp"
+#include "midiClockFollower.hpp"
+#include "groove.hpp"
+#include "divisions.hpp"
+#ifdef CLOCK_INSTRUMENTATION
+#include "gateLog.hpp"
+#endif
+
 #include <cstdint>
 #include <math.h>
 
+// how far in beats the host may be off the expected position before it
+// counts as a loop or a seek
+#define CLOCK_JUMP_TOLERANCE 0.01
+
 enum SyncMode {
 	FREE_RUNNING = 0,
 	HOST_BPM_SYNC,
-	HOST_QUANTIZED_SYNC
+	HOST_QUANTIZED_SYNC,
+	MIDI_CLOCK_SYNC
 };
 
 class PluginClock {
 public:
 	PluginClock();
 	~PluginClock();
-	void transmitHostInfo(const bool playing, const float beatstPerBar,
-			const int hostBeat, const float hostBarBeat, const float hostBpm);
+	void transmitHostInfo(const TimePosition& position);
+	void receiveMidiClock(const MidiEvent& event);
 	void setSampleRate(float sampleRate);
 	void setSyncMode(int mode);
 	void setInternalBpmValue(float internalBpm);
 	void setDivision(int division);
+	void setSwing(float swing);
+	void setGroove(const GrooveTemplate& groove);
 	void syncClock();
 	void setPos(uint32_t pos);
-	void setNumBarsElapsed(uint32_t numBarsElapsed);
 	void calcPeriod();
 	void closeGate();
 	void reset();
 	bool getGate() const;
+	float getGateScale() const;
 	float getSampleRate() const;
 	int getSyncMode() const;
 	float getInternalBpmValue() const;
 	int getDivision() const;
 	uint32_t getPeriod() const;
+	void getPeriodRatio(uint64_t& numerator, uint64_t& denominator) const;
 	uint32_t getPos() const;
+	uint32_t getFramesUntilGate() const;
+	bool wasRelocated() const;
+	double getJumpBeats() const;
+	bool isPlaying() const;
+	bool isRunning() const;
+	uint32_t getSwitchFrames() const;
+	double getSongTicks() const;
+	double getTicksPerFrame() const;
+	double getTicksPerFrameSlope() const;
+	void update(uint32_t frames);
+	void advance(uint32_t frames);
+	void skip(uint32_t frames);
 	void tick();
+#ifdef CLOCK_INSTRUMENTATION
+	void setGateLog(GateLog* gateLog);
+	void logHeldFrames(uint32_t frames);
+#endif
 
 private:
-	void setBpm(float bpm);
+	void setBpm(float bpm, double bpmSlope, double phaseOffset);
+	double getPhase() const;
+	void setPhase(double phase);
+	void setRamp(double phase, double bpmSlope);
+	uint32_t getRampFrames(double phase) const;
+	double getStepsPerFrame(double bpm) const;
+	double getHostPos(int64_t& steps) const;
+	double getHostJump(const TimePosition& position) const;
+	double getTicksPerStep() const;
+	double getTickPhase(double ticks) const;
+	void followMidiClock();
+	void run(uint32_t frames);
+	void calcGroove();
+	int32_t getGrooveFrames(int64_t step) const;
+	void openGate();
+	void addPendingGate(uint32_t frames, int64_t step);
+	void clearPendingGates();
+	uint32_t getRunningFramesUntilGate() const;
+	void nextCycle();
+	void calcLength();
+#ifdef CLOCK_INSTRUMENTATION
+	void updateLog(uint32_t frames);
+	void logGate(uint32_t frame);
+#endif
 
 	bool gate;
 	bool trigger;
@@ -44,37 +99,97 @@ private:
 	bool phaseReset;
 	bool playing;
 	bool previousPlaying;
-	bool endOfBar;
+	bool resync;
+	bool ramping;
 	bool init;
 
 	uint32_t period;
 	uint32_t halfWavelength;
 	uint32_t quarterWaveLength;
+	uint32_t length;
 	uint32_t pos;
 
+	// steps since the song position the clock was last set to
+	int64_t stepCount;
+
+	// frames per step as an exact ratio, the remainder of each step is
+	// carried over so the steps never drift from the ideal grid
+	uint64_t periodRemainder;
+	uint64_t periodDenominator;
+	uint64_t carry;
+
+	// while the tempo ramps a step is measured in phase, from where it was at
+	// rampPos on, in steps per frame and the change of that every frame
+	double stepsPerFrame;
+	double stepsPerFrameSlope;
+	double rampPhase;
+	uint32_t rampPos;
+
+	// with a groove the gates move off the grid, by frames per step that are
+	// worked out whenever the period changes. A gate that comes later than
+	// its step waits here, one that comes early is set up by the step before.
+	float swing;
+	GrooveTemplate groove;
+	int32_t grooveFrames[GROOVE_MAX_STEPS];
+	int32_t swingFrames;
+	bool grooveActive;
+	uint32_t pendingFrames[2];
+	int64_t pendingSteps[2];
+	unsigned numPendingGates;
+	int64_t earlyStep;
+	int64_t gateStep;
+
+	// with an external clock the clock only runs between its start and stop,
+	// which can fall anywhere in a block
+	MidiClockFollower midiClock;
+	bool running;
+	uint32_t switchFrames;
+
+	// a jump of the host position is found by where it lands against where
+	// it was expected, it takes the clock straight to the new position
+	bool relocated;
+	double jumpBeats;
+	uint64_t hostFrame;
+	uint64_t nextHostFrame;
+
+#ifdef CLOCK_INSTRUMENTATION
+	// gates are measured against a timeline in beats, the host position in
+	// quantized sync, the external clock in MIDI clock sync, and the tempo
+	// from the first gate on otherwise
+	GateLog* gateLog;
+	uint64_t logBlockStart;
+	uint32_t logBlockFrames;
+	uint32_t logBlockPos;
+	double logBeats;
+	double logBarBeat;
+	double logBeatsPerFrame;
+	double logOrigin;
+	bool logValid;
+	bool logOriginValid;
+	int logSyncMode;
+#endif
+
 	float beatsPerBar;
 	float bpm;
 	float internalBpm;
 	float hostBpm;
 	float previousBpm;
+	float previousHostBpm;
+	double previousHostBpmSlope;
+	double rampSlope;
 	float sampleRate;
 	int division;
-	float divisionValue;
+	uint32_t blockFrames;
 
-	float hostBarBeat;
 	float beatTick;
 	int syncMode;
 	int previousSyncMode;
-	int hostTick;
+	int hostBar;
 	int hostBeat;
+	double hostBeatFraction;
 	int barLength;
-	int numBarsElapsed;
-	int previousBeat;
 
 	int arpMode;
-
-    // "1/1" "1/2" "1/3" "1/4" "1/4." "1/4T" "1/8" "1/8." "1/8T" "1/16" "1/16." "1/16T" "1/32"
-	float divisionValues[13] {0.5, 1, 1.5, 2.0, 2.66666, 3.0, 4.0, 5.33333, 6.0, 8.0, 10.66666, 12.0, 16.0};
 };
 
 #endif
@@ -0,0 +1,110 @@
+#ifndef _H_DIVISIONS_
+#define _H_DIVISIONS_
+
+#include <cstdint>
+
+#define NUM_DIVISIONS 42
+
+enum DivisionKind {
+	DIVISION_PLAIN = 0,
+	DIVISION_DOTTED,
+	DIVISION_DOUBLE_DOTTED,
+	DIVISION_TRIPLET,
+	DIVISION_QUINTUPLET,
+	DIVISION_SEPTUPLET
+};
+
+// The length of a step as a note value. The clock counts in steps per two
+// beats, kept as an exact numerator and denominator.
+struct Division {
+	const char* label;
+	uint32_t numerator;
+	uint32_t denominator;
+};
+
+// length of a step relative to the plain note value
+constexpr uint32_t getKindNumerator(DivisionKind kind)
+{
+	return kind == DIVISION_DOTTED ? 3 : kind == DIVISION_DOUBLE_DOTTED ? 7 :
+			kind == DIVISION_TRIPLET ? 2 : kind == DIVISION_QUINTUPLET ? 4 :
+			kind == DIVISION_SEPTUPLET ? 4 : 1;
+}
+
+constexpr uint32_t getKindDenominator(DivisionKind kind)
+{
+	return kind == DIVISION_DOTTED ? 2 : kind == DIVISION_DOUBLE_DOTTED ? 4 :
+			kind == DIVISION_TRIPLET ? 3 : kind == DIVISION_QUINTUPLET ? 5 :
+			kind == DIVISION_SEPTUPLET ? 7 : 1;
+}
+
+constexpr uint32_t getCommonDivisor(uint32_t a, uint32_t b)
+{
+	return b == 0 ? a : getCommonDivisor(b, a % b);
+}
+
+constexpr Division makeDivision(const char* label, uint32_t numerator, uint32_t denominator)
+{
+	return Division {label, numerator / getCommonDivisor(numerator, denominator),
+			denominator / getCommonDivisor(numerator, denominator)};
+}
+
+// a 1/note step lasts 4/note beats, so two beats hold note / 2 of them
+constexpr Division makeDivision(const char* label, uint32_t note, DivisionKind kind)
+{
+	return makeDivision(label, note * getKindDenominator(kind), 2 * getKindNumerator(kind));
+}
+
+// The first 13 are the divisions the plugin always had and keep their index
+// and length, so saved settings play the same. Their dotted values were
+// labelled an octave too long, "1/4." played a dotted eighth.
+static constexpr Division divisions[NUM_DIVISIONS] = {
+	makeDivision("1/1", 1, DIVISION_PLAIN),
+	makeDivision("1/2", 2, DIVISION_PLAIN),
+	makeDivision("1/2T", 2, DIVISION_TRIPLET),
+	makeDivision("1/4", 4, DIVISION_PLAIN),
+	makeDivision("1/8.", 8, DIVISION_DOTTED),
+	makeDivision("1/4T", 4, DIVISION_TRIPLET),
+	makeDivision("1/8", 8, DIVISION_PLAIN),
+	makeDivision("1/16.", 16, DIVISION_DOTTED),
+	makeDivision("1/8T", 8, DIVISION_TRIPLET),
+	makeDivision("1/16", 16, DIVISION_PLAIN),
+	makeDivision("1/32.", 32, DIVISION_DOTTED),
+	makeDivision("1/16T", 16, DIVISION_TRIPLET),
+	makeDivision("1/32", 32, DIVISION_PLAIN),
+
+	makeDivision("1/1.", 1, DIVISION_DOTTED),
+	makeDivision("1/1..", 1, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/1T", 1, DIVISION_TRIPLET),
+	makeDivision("1/1 Quint", 1, DIVISION_QUINTUPLET),
+	makeDivision("1/1 Sept", 1, DIVISION_SEPTUPLET),
+	makeDivision("1/2.", 2, DIVISION_DOTTED),
+	makeDivision("1/2..", 2, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/2 Quint", 2, DIVISION_QUINTUPLET),
+	makeDivision("1/2 Sept", 2, DIVISION_SEPTUPLET),
+	makeDivision("1/4.", 4, DIVISION_DOTTED),
+	makeDivision("1/4..", 4, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/4 Quint", 4, DIVISION_QUINTUPLET),
+	makeDivision("1/4 Sept", 4, DIVISION_SEPTUPLET),
+	makeDivision("1/8..", 8, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/8 Quint", 8, DIVISION_QUINTUPLET),
+	makeDivision("1/8 Sept", 8, DIVISION_SEPTUPLET),
+	makeDivision("1/16..", 16, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/16 Quint", 16, DIVISION_QUINTUPLET),
+	makeDivision("1/16 Sept", 16, DIVISION_SEPTUPLET),
+	makeDivision("1/32..", 32, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/32T", 32, DIVISION_TRIPLET),
+	makeDivision("1/32 Quint", 32, DIVISION_QUINTUPLET),
+	makeDivision("1/32 Sept", 32, DIVISION_SEPTUPLET),
+	makeDivision("1/64", 64, DIVISION_PLAIN),
+	makeDivision("1/64.", 64, DIVISION_DOTTED),
+	makeDivision("1/64..", 64, DIVISION_DOUBLE_DOTTED),
+	makeDivision("1/64T", 64, DIVISION_TRIPLET),
+	makeDivision("1/64 Quint", 64, DIVISION_QUINTUPLET),
+	makeDivision("1/64 Sept", 64, DIVISION_SEPTUPLET)
+};
+
+static_assert(divisions[4].numerator == 8 && divisions[4].denominator == 3, "legacy division changed");
+static_assert(divisions[10].numerator == 32 && divisions[10].denominator == 3, "legacy division changed");
+static_assert(divisions[12].numerator == 16 && divisions[12].denominator == 1, "legacy division changed");
+
+#endif //_H_DIVISIONS_
@@ -0,0 +1,48 @@
+#include "gateLog.hpp"
+
+static_assert((GATE_LOG_SIZE & (GATE_LOG_SIZE - 1)) == 0, "GATE_LOG_SIZE must be a power of two");
+
+GateLog::GateLog() :
+	writeIndex(0),
+	readIndex(0),
+	dropped(0)
+{
+}
+
+GateLog::~GateLog()
+{
+}
+
+bool GateLog::push(const GateRecord& record)
+{
+	const uint32_t write = writeIndex.load(std::memory_order_relaxed);
+
+	if (write - readIndex.load(std::memory_order_acquire) == GATE_LOG_SIZE) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	records[write & (GATE_LOG_SIZE - 1)] = record;
+	writeIndex.store(write + 1, std::memory_order_release);
+
+	return true;
+}
+
+bool GateLog::pop(GateRecord& record)
+{
+	const uint32_t read = readIndex.load(std::memory_order_relaxed);
+
+	if (read == writeIndex.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	record = records[read & (GATE_LOG_SIZE - 1)];
+	readIndex.store(read + 1, std::memory_order_release);
+
+	return true;
+}
+
+uint32_t GateLog::getDropped() const
+{
+	return dropped.load(std::memory_order_relaxed);
+}
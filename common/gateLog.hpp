@@ -0,0 +1,35 @@
+#ifndef _H_GATE_LOG_
+#define _H_GATE_LOG_
+
+#include <atomic>
+#include <cstdint>
+
+#define GATE_LOG_SIZE 4096
+
+// where a gate opened against where the grid says it should have
+struct GateRecord {
+	uint64_t frame;
+	int64_t step;
+	double error;
+	int syncMode;
+	int division;
+};
+
+// Single producer, single consumer ring buffer of gate timings. The clock
+// writes to it from the audio thread, and records that find it full are
+// counted and dropped. Any other thread may read them out in order.
+class GateLog {
+public:
+	GateLog();
+	~GateLog();
+	bool push(const GateRecord& record);
+	bool pop(GateRecord& record);
+	uint32_t getDropped() const;
+private:
+	GateRecord records[GATE_LOG_SIZE];
+	std::atomic<uint32_t> writeIndex;
+	std::atomic<uint32_t> readIndex;
+	std::atomic<uint32_t> dropped;
+};
+
+#endif //_H_GATE_LOG_
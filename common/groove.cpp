@@ -0,0 +1,24 @@
+#include "groove.hpp"
+
+const GrooveTemplate grooveTemplates[NUM_GROOVE_TEMPLATES] = {
+	{"Straight", 2,
+		{0.f, 0.f},
+		{1.f, 1.f}},
+	{"Staccato Offbeats", 2,
+		{0.f, 0.f},
+		{1.f, 0.5f}},
+	{"Accent 3-3-2", 8,
+		{0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f},
+		{1.4f, 0.7f, 0.7f, 1.4f, 0.7f, 0.7f, 1.4f, 0.7f}},
+	{"Laid Back", 4,
+		{0.f, 0.04f, 0.02f, 0.06f},
+		{1.f, 0.9f, 1.f, 0.9f}},
+	{"Push", 4,
+		{0.f, -0.04f, 0.f, -0.06f},
+		{1.f, 0.8f, 1.f, 0.8f}},
+	{"Humanize", 16,
+		{0.f, 0.02f, -0.01f, 0.03f, 0.01f, -0.02f, 0.02f, 0.f,
+		 -0.01f, 0.03f, 0.f, 0.02f, -0.02f, 0.01f, 0.03f, -0.01f},
+		{1.f, 0.95f, 1.05f, 0.9f, 1.f, 1.1f, 0.95f, 1.f,
+		 1.05f, 0.9f, 1.f, 0.95f, 1.1f, 1.f, 0.9f, 1.05f}}
+};
@@ -0,0 +1,22 @@
+#ifndef _H_GROOVE_
+#define _H_GROOVE_
+
+#include <cstdint>
+
+#define GROOVE_MIN_STEPS 2
+#define GROOVE_MAX_STEPS 32
+#define NUM_GROOVE_TEMPLATES 6
+
+// Timing and note length of the steps in a repeating groove. Offsets are in
+// steps, later is positive, and are taken relative to the first step so the
+// groove starts on the grid. Gates scale the note length of each step.
+struct GrooveTemplate {
+	const char* name;
+	unsigned numSteps;
+	float offsets[GROOVE_MAX_STEPS];
+	float gates[GROOVE_MAX_STEPS];
+};
+
+extern const GrooveTemplate grooveTemplates[NUM_GROOVE_TEMPLATES];
+
+#endif //_H_GROOVE_
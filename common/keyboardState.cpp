@@ -0,0 +1,133 @@
+#include "keyboardState.hpp"
+
+KeyboardState::KeyboardState()
+{
+	clear();
+}
+
+KeyboardState::~KeyboardState()
+{
+}
+
+void KeyboardState::clear()
+{
+	held[0] = 0;
+	held[1] = 0;
+	firstPlayed = NO_NOTE;
+	lastPlayed = NO_NOTE;
+	numNotes = 0;
+}
+
+bool KeyboardState::noteOn(uint8_t note, uint8_t channel)
+{
+	if (note >= NUM_MIDI_NOTES || isHeld(note)) {
+		return false;
+	}
+
+	held[note >> 6] |= UINT64_C(1) << (note & 63);
+	channels[note] = channel;
+
+	previousPlayed[note] = lastPlayed;
+	nextPlayed[note] = NO_NOTE;
+	if (lastPlayed != NO_NOTE) {
+		nextPlayed[lastPlayed] = note;
+	} else {
+		firstPlayed = note;
+	}
+	lastPlayed = note;
+
+	numNotes++;
+
+	return true;
+}
+
+bool KeyboardState::noteOff(uint8_t note)
+{
+	if (note >= NUM_MIDI_NOTES || !isHeld(note)) {
+		return false;
+	}
+
+	held[note >> 6] &= ~(UINT64_C(1) << (note & 63));
+
+	if (previousPlayed[note] != NO_NOTE) {
+		nextPlayed[previousPlayed[note]] = nextPlayed[note];
+	} else {
+		firstPlayed = nextPlayed[note];
+	}
+	if (nextPlayed[note] != NO_NOTE) {
+		previousPlayed[nextPlayed[note]] = previousPlayed[note];
+	} else {
+		lastPlayed = previousPlayed[note];
+	}
+
+	numNotes--;
+
+	return true;
+}
+
+bool KeyboardState::isHeld(uint8_t note) const
+{
+	return note < NUM_MIDI_NOTES && ((held[note >> 6] >> (note & 63)) & 1);
+}
+
+int KeyboardState::getNumNotes() const
+{
+	return numNotes;
+}
+
+uint8_t KeyboardState::getChannel(uint8_t note) const
+{
+	return channels[note];
+}
+
+// lowest to highest, one count-trailing-zeros per held note
+int KeyboardState::getSortedNotes(uint8_t* notes, int maxNotes) const
+{
+	int count = 0;
+
+	for (unsigned w = 0; w < 2; w++) {
+		uint64_t bits = held[w];
+
+		while (bits != 0 && count < maxNotes) {
+			notes[count++] = static_cast<uint8_t>((w << 6) + __builtin_ctzll(bits));
+			bits &= bits - 1;
+		}
+	}
+
+	return count;
+}
+
+int KeyboardState::getPlayedNotes(uint8_t* notes, int maxNotes) const
+{
+	int count = 0;
+
+	for (uint8_t note = firstPlayed; note != NO_NOTE && count < maxNotes; note = nextPlayed[note]) {
+		notes[count++] = note;
+	}
+
+	return count;
+}
+
+// number of held notes below this pitch, where the note is or would go in getSortedNotes()
+int KeyboardState::getSortedIndex(uint8_t note) const
+{
+	const unsigned w = (note >> 6) & 1;
+	const uint64_t below = held[w] & ((UINT64_C(1) << (note & 63)) - 1);
+
+	return __builtin_popcountll(below) + ((w == 1) ? __builtin_popcountll(held[0]) : 0);
+}
+
+// position of a held note in getPlayedNotes(), -1 if it is not held
+int KeyboardState::getPlayedIndex(uint8_t note) const
+{
+	int index = 0;
+
+	for (uint8_t played = firstPlayed; played != NO_NOTE; played = nextPlayed[played]) {
+		if (played == note) {
+			return index;
+		}
+		index++;
+	}
+
+	return -1;
+}
@@ -0,0 +1,35 @@
+#ifndef _H_KEYBOARD_STATE_
+#define _H_KEYBOARD_STATE_
+
+#include <cstdint>
+
+#define NUM_MIDI_NOTES 128
+#define NO_NOTE 0xFF
+
+// Held notes as a 128 bit set of pitches, plus the order they were played in.
+// Each pitch is held at most once and remembers the channel it came in on.
+class KeyboardState {
+public:
+	KeyboardState();
+	~KeyboardState();
+	void clear();
+	bool noteOn(uint8_t note, uint8_t channel);
+	bool noteOff(uint8_t note);
+	bool isHeld(uint8_t note) const;
+	int getNumNotes() const;
+	uint8_t getChannel(uint8_t note) const;
+	int getSortedNotes(uint8_t* notes, int maxNotes) const;
+	int getPlayedNotes(uint8_t* notes, int maxNotes) const;
+	int getSortedIndex(uint8_t note) const;
+	int getPlayedIndex(uint8_t note) const;
+private:
+	uint64_t held[2];
+	uint8_t channels[NUM_MIDI_NOTES];
+	uint8_t nextPlayed[NUM_MIDI_NOTES];
+	uint8_t previousPlayed[NUM_MIDI_NOTES];
+	uint8_t firstPlayed;
+	uint8_t lastPlayed;
+	int numNotes;
+};
+
+#endif //_H_KEYBOARD_STATE_
@@ -0,0 +1,162 @@
+#include "midiClockFollower.hpp"
+#include "midiHandler.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+// loop bandwidth in Hz, wider for the first beat so the tempo is found quickly
+#define MIDI_CLOCK_BANDWIDTH 1.0
+#define MIDI_CLOCK_LOCK_BANDWIDTH 4.0
+#define MIDI_CLOCK_MAX_OMEGA 0.5
+
+MidiClockFollower::MidiClockFollower() :
+	sampleRate(48000.f),
+	blockStart(0)
+{
+	reset();
+}
+
+MidiClockFollower::~MidiClockFollower()
+{
+}
+
+void MidiClockFollower::setSampleRate(float sampleRate)
+{
+	if (sampleRate != this->sampleRate) {
+		this->sampleRate = sampleRate;
+		numTicks = 0;
+		tickPeriod = 0.0;
+	}
+}
+
+void MidiClockFollower::reset()
+{
+	running = false;
+	previousRunning = false;
+	pendingStart = false;
+	switchFrame = UINT32_MAX;
+	songPosition = 0;
+	startTicks = 0;
+	tickCount = 0;
+	numTicks = 0;
+	lastTickFrame = 0;
+	tickTime = 0.0;
+	tickPeriod = 0.0;
+}
+
+void MidiClockFollower::process(const MidiEvent& event)
+{
+	switch (event.data[0])
+	{
+		case MIDI_TIMING_CLOCK:
+			clockTick(blockStart + event.frame);
+			break;
+		case MIDI_START:
+			songPosition = 0;
+			pendingStart = true;
+			break;
+		case MIDI_CONTINUE:
+			pendingStart = true;
+			break;
+		case MIDI_STOP:
+			if (running) {
+				songPosition = tickCount + 1;
+				switchFrame = event.frame;
+			}
+			running = false;
+			pendingStart = false;
+			break;
+		case MIDI_SONG_POSITION_POINTER:
+			// only meant to be sent while stopped, in sixteenth notes
+			if (!running && event.size >= 3) {
+				songPosition = static_cast<int64_t>(event.data[1] | (event.data[2] << 7)) * MIDI_CLOCK_TICKS_PER_SIXTEENTH;
+			}
+			break;
+	}
+}
+
+void MidiClockFollower::clockTick(uint64_t frame)
+{
+	if (numTicks == 0) {
+		tickTime = frame;
+	} else if (numTicks == 1) {
+		tickPeriod = static_cast<double>(frame - lastTickFrame);
+		tickTime = frame;
+	} else {
+		const double error = static_cast<double>(frame) - (tickTime + tickPeriod);
+
+		if (fabs(error) > 0.5 * tickPeriod) {
+			// a dropout or a jump in tempo, lock on again from this tick
+			numTicks = 0;
+			tickTime = frame;
+		} else {
+			const double bandwidth = (numTicks < MIDI_CLOCK_PPQN) ? MIDI_CLOCK_LOCK_BANDWIDTH : MIDI_CLOCK_BANDWIDTH;
+			const double omega = std::min(2.0 * M_PI * bandwidth * tickPeriod / sampleRate, MIDI_CLOCK_MAX_OMEGA);
+
+			tickTime += tickPeriod + M_SQRT2 * omega * error;
+			tickPeriod += omega * omega * error;
+		}
+	}
+	lastTickFrame = frame;
+	numTicks = (numTicks < UINT32_MAX) ? numTicks + 1 : numTicks;
+
+	if (pendingStart) {
+		running = true;
+		pendingStart = false;
+		switchFrame = static_cast<uint32_t>(frame - blockStart);
+		startTicks = songPosition;
+		tickCount = songPosition;
+	} else if (running) {
+		tickCount++;
+	}
+}
+
+void MidiClockFollower::nextBlock(uint32_t frames)
+{
+	blockStart += frames;
+	previousRunning = running;
+	switchFrame = UINT32_MAX;
+}
+
+bool MidiClockFollower::isRunning() const
+{
+	return running;
+}
+
+bool MidiClockFollower::wasRunning() const
+{
+	return previousRunning;
+}
+
+// where in the block the clock started or stopped, UINT32_MAX for neither
+uint32_t MidiClockFollower::getSwitchFrame() const
+{
+	return (running != previousRunning) ? switchFrame : UINT32_MAX;
+}
+
+int64_t MidiClockFollower::getStartTicks() const
+{
+	return startTicks;
+}
+
+bool MidiClockFollower::hasTempo() const
+{
+	return tickPeriod > 0.0;
+}
+
+// the position is only followed while the ticks keep coming
+bool MidiClockFollower::isLocked(uint32_t frame) const
+{
+	return numTicks >= 2 && static_cast<double>(blockStart + frame) < lastTickFrame + 2.0 * tickPeriod;
+}
+
+float MidiClockFollower::getBpm() const
+{
+	return static_cast<float>(sampleRate * 60.0 / (MIDI_CLOCK_PPQN * tickPeriod));
+}
+
+// song position in ticks, carried on from the last tick at the filtered period
+double MidiClockFollower::getTicks(uint32_t frame) const
+{
+	return tickCount + (static_cast<double>(blockStart + frame) - tickTime) / tickPeriod;
+}
@@ -0,0 +1,53 @@
+#ifndef _H_MIDI_CLOCK_FOLLOWER_
+#define _H_MIDI_CLOCK_FOLLOWER_
+
+#include "DistrhoPlugin.hpp"
+
+#include <cstdint>
+
+#define MIDI_CLOCK_PPQN 24
+#define MIDI_CLOCK_TICKS_PER_SIXTEENTH 6
+
+// Follows an external 24 PPQN MIDI clock. The tick times go through a
+// second order delay-locked loop, which smooths the jitter of USB-MIDI
+// into a steady tick period and a position that can be read at any frame.
+// Frames of incoming events count from the start of the current block.
+class MidiClockFollower {
+public:
+	MidiClockFollower();
+	~MidiClockFollower();
+	void setSampleRate(float sampleRate);
+	void reset();
+	void process(const MidiEvent& event);
+	void nextBlock(uint32_t frames);
+	bool isRunning() const;
+	bool wasRunning() const;
+	uint32_t getSwitchFrame() const;
+	int64_t getStartTicks() const;
+	bool hasTempo() const;
+	bool isLocked(uint32_t frame) const;
+	float getBpm() const;
+	double getTicks(uint32_t frame) const;
+private:
+	void clockTick(uint64_t frame);
+
+	float sampleRate;
+	uint64_t blockStart;
+
+	// transport, the clock starts on the first tick after a start or continue
+	bool running;
+	bool previousRunning;
+	bool pendingStart;
+	uint32_t switchFrame;
+	int64_t songPosition;
+	int64_t startTicks;
+	int64_t tickCount;
+
+	// the loop, tickTime is the filtered frame of the last tick
+	uint32_t numTicks;
+	uint64_t lastTickFrame;
+	double tickTime;
+	double tickPeriod;
+};
+
+#endif
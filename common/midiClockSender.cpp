@@ -0,0 +1,217 @@
+#include "midiClockSender.hpp"
+
+#include <math.h>
+
+// how far the grid may move between blocks before it counts as relocated
+#define MIDI_CLOCK_SENDER_TOLERANCE 0.5
+
+MidiClockSender::MidiClockSender() :
+	enabled(false),
+	tracking(false),
+	running(false),
+	pendingStart(false),
+	stopFrame(UINT32_MAX),
+	segmentStart(0),
+	segmentEnd(0),
+	segmentTicks(0.0),
+	ticksPerFrame(0.0),
+	ticksPerFrameSlope(0.0),
+	endTicks(0.0),
+	nextTick(0),
+	groupSize(0),
+	groupIndex(0)
+{
+}
+
+MidiClockSender::~MidiClockSender()
+{
+}
+
+void MidiClockSender::setEnabled(bool enabled)
+{
+	this->enabled = enabled;
+}
+
+bool MidiClockSender::getEnabled() const
+{
+	return enabled;
+}
+
+void MidiClockSender::stop(uint32_t frame)
+{
+	if (running) {
+		stopFrame = frame;
+		running = false;
+	}
+	pendingStart = false;
+}
+
+// takes the grid at the start of the block, playing is the transport that
+// Start, Stop and Continue follow
+void MidiClockSender::schedule(const PluginClock& clock, bool playing, uint32_t frames)
+{
+	groupSize = 0;
+	groupIndex = 0;
+	stopFrame = UINT32_MAX;
+	segmentStart = frames;
+	segmentEnd = frames;
+
+	if (!enabled) {
+		stop(0);
+		tracking = false;
+		return;
+	}
+
+	// the clock may start or stop running somewhere in the block
+	const uint32_t switchFrames = clock.getSwitchFrames();
+	if (clock.isRunning()) {
+		segmentStart = 0;
+		segmentEnd = (switchFrames < frames) ? switchFrames : frames;
+	} else if (switchFrames < frames) {
+		segmentStart = switchFrames;
+	}
+
+	segmentTicks = clock.getSongTicks();
+	ticksPerFrame = clock.getTicksPerFrame();
+	ticksPerFrameSlope = clock.getTicksPerFrameSlope();
+
+	// a seek, a loop or a new division moves the grid, downstream is
+	// stopped and continues from the new position
+	if (!tracking || fabs(segmentTicks - endTicks) > MIDI_CLOCK_SENDER_TOLERANCE) {
+		nextTick = static_cast<int64_t>(ceil(segmentTicks - 1e-4));
+		stop(0);
+		tracking = true;
+	}
+
+	if (!playing) {
+		stop(0);
+	} else if (segmentEnd < frames) {
+		stop(segmentEnd);
+	} else if (!running) {
+		pendingStart = true;
+	}
+
+	const double segmentFrames = segmentEnd - segmentStart;
+	endTicks = segmentTicks + segmentFrames * (ticksPerFrame + 0.5 * ticksPerFrameSlope * segmentFrames);
+}
+
+// the grid stands still, the arpeggio is waiting for its first note
+void MidiClockSender::hold(uint32_t frames)
+{
+	groupSize = 0;
+	groupIndex = 0;
+	stopFrame = UINT32_MAX;
+	segmentStart = frames;
+	segmentEnd = frames;
+
+	stop(0);
+	tracking = false;
+}
+
+// the grid starts over from the beginning of the song on frame
+void MidiClockSender::start(const PluginClock& clock, uint32_t frame)
+{
+	if (!enabled) {
+		return;
+	}
+
+	segmentStart = frame;
+	segmentTicks = 0.0;
+	ticksPerFrame = clock.getTicksPerFrame();
+	ticksPerFrameSlope = 0.0;
+	nextTick = 0;
+	pendingStart = true;
+	tracking = true;
+
+	endTicks = (segmentEnd - segmentStart) * ticksPerFrame;
+}
+
+// the first frame on which the grid is at or past tick
+uint32_t MidiClockSender::getTickFrame(int64_t tick) const
+{
+	const double remaining = tick - segmentTicks;
+
+	if (remaining <= 0.0) {
+		return segmentStart;
+	}
+
+	double frames;
+	if (ticksPerFrameSlope != 0.0) {
+		const double discriminant = ticksPerFrame * ticksPerFrame + 2.0 * ticksPerFrameSlope * remaining;
+		if (discriminant < 0.0 || ticksPerFrame + sqrt(discriminant) <= 0.0) {
+			return UINT32_MAX;
+		}
+		frames = 2.0 * remaining / (ticksPerFrame + sqrt(discriminant));
+	} else if (ticksPerFrame > 0.0) {
+		frames = remaining / ticksPerFrame;
+	} else {
+		return UINT32_MAX;
+	}
+
+	frames = ceil(frames - 1e-4);
+
+	return (frames < segmentEnd - segmentStart) ? segmentStart + static_cast<uint32_t>(frames) : UINT32_MAX;
+}
+
+void MidiClockSender::appendEvent(uint32_t frame, uint8_t status, uint8_t data1, uint8_t data2, uint8_t size)
+{
+	MidiEvent& event = group[groupSize++];
+
+	event.frame = frame;
+	event.size = size;
+	event.data[0] = status;
+	event.data[1] = data1;
+	event.data[2] = data2;
+	event.data[3] = 0;
+	event.dataExt = nullptr;
+}
+
+// a stop goes first, a start or continue goes right before the tick it
+// starts on, which has to be on a sixteenth note for the song position
+void MidiClockSender::fillGroup()
+{
+	groupSize = 0;
+	groupIndex = 0;
+
+	const uint32_t tickFrame = (segmentStart < segmentEnd) ? getTickFrame(nextTick) : UINT32_MAX;
+
+	if (stopFrame != UINT32_MAX && stopFrame <= tickFrame) {
+		appendEvent(stopFrame, MIDI_STOP, 0, 0, 1);
+		stopFrame = UINT32_MAX;
+		return;
+	}
+	if (tickFrame == UINT32_MAX) {
+		return;
+	}
+
+	if (pendingStart && nextTick >= 0 && nextTick % MIDI_CLOCK_TICKS_PER_SIXTEENTH == 0) {
+		if (nextTick == 0) {
+			appendEvent(tickFrame, MIDI_START, 0, 0, 1);
+		} else {
+			const uint32_t sixteenths = static_cast<uint32_t>(nextTick / MIDI_CLOCK_TICKS_PER_SIXTEENTH) & 0x3FFF;
+			appendEvent(tickFrame, MIDI_SONG_POSITION_POINTER, sixteenths & 0x7F, sixteenths >> 7, 3);
+			appendEvent(tickFrame, MIDI_CONTINUE, 0, 0, 1);
+		}
+		pendingStart = false;
+		running = true;
+	}
+
+	appendEvent(tickFrame, MIDI_TIMING_CLOCK, 0, 0, 1);
+	nextTick++;
+}
+
+const MidiEvent* MidiClockSender::peekEvent()
+{
+	if (groupIndex == groupSize) {
+		fillGroup();
+	}
+
+	return (groupIndex < groupSize) ? &group[groupIndex] : nullptr;
+}
+
+void MidiClockSender::popEvent()
+{
+	if (groupIndex < groupSize) {
+		groupIndex++;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef _H_MIDI_CLOCK_SENDER_
+#define _H_MIDI_CLOCK_SENDER_
+
+#include "DistrhoPlugin.hpp"
+#include "clock.hpp"
+#include "midiHandler.hpp"
+
+#include <cstdint>
+
+// Sends 24 PPQN MIDI clock and transport along the step grid of a
+// PluginClock. Each block the position and tempo of the grid are taken
+// once, the ticks are then worked out one by one as the output is written,
+// in between the events of the arpeggiator.
+class MidiClockSender : public MidiEventSource {
+public:
+	MidiClockSender();
+	~MidiClockSender();
+	void setEnabled(bool enabled);
+	bool getEnabled() const;
+	void schedule(const PluginClock& clock, bool playing, uint32_t frames);
+	void hold(uint32_t frames);
+	void start(const PluginClock& clock, uint32_t frame);
+	const MidiEvent* peekEvent() override;
+	void popEvent() override;
+private:
+	void stop(uint32_t frame);
+	void fillGroup();
+	uint32_t getTickFrame(int64_t tick) const;
+	void appendEvent(uint32_t frame, uint8_t status, uint8_t data1, uint8_t data2, uint8_t size);
+
+	bool enabled;
+	bool tracking;
+	bool running;
+	bool pendingStart;
+	uint32_t stopFrame;
+
+	// where the grid moves in this block, from segmentTicks at segmentStart on
+	uint32_t segmentStart;
+	uint32_t segmentEnd;
+	double segmentTicks;
+	double ticksPerFrame;
+	double ticksPerFrameSlope;
+	double endTicks;
+	int64_t nextTick;
+
+	// the events that go out together on the next frame
+	MidiEvent group[3];
+	unsigned groupSize;
+	unsigned groupIndex;
+};
+
+#endif
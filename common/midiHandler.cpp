@@ -1,6 +1,13 @@
 #include "midiHandler.hpp"
 
-MidiHandler::MidiHandler()
+#include <algorithm>
+
+MidiHandler::MidiHandler() :
+	sink(nullptr),
+	source(nullptr),
+	numWrittenEvents(0),
+	droppedEvents(0),
+	droppedNoteOffs(0)
 {
 }
 
@@ -8,33 +15,91 @@ MidiHandler::~MidiHandler()
 {
 }
 
-void MidiHandler::emptyMidiBuffer()
+void MidiHandler::setSink(MidiEventSink* sink)
+{
+	this->sink = sink;
+}
+
+void MidiHandler::setSource(MidiEventSource* source)
+{
+	this->source = source;
+}
+
+void MidiHandler::nextBlock()
 {
-	buffer.numBufferedEvents = 0;
-	buffer.numBufferedThroughEvents = 0;
+	numWrittenEvents = 0;
 }
 
-void MidiHandler::appendMidiMessage(MidiEvent event)
+static bool isNoteOff(const MidiEvent& event)
 {
-	buffer.bufferedEvents[buffer.numBufferedEvents] = event;
-	buffer.numBufferedEvents = (buffer.numBufferedEvents + 1) % buffer.maxBufferSize;
+	const uint8_t status = event.data[0] & 0xF0;
+
+	return status == MIDI_NOTEOFF || (status == MIDI_NOTEON && event.data[2] == 0)
+		|| (status == 0xB0 && event.data[1] == 0x7B);
 }
 
-void MidiHandler::appendMidiThroughMessage(MidiEvent event)
+// once the block or the sink is nearly full only note-offs get through, an
+// event the sink refuses is dropped the same way
+void MidiHandler::writeEvent(const MidiEvent& event)
 {
-	buffer.bufferedMidiThroughEvents[buffer.numBufferedThroughEvents] = event;
-	buffer.numBufferedThroughEvents = (buffer.numBufferedThroughEvents + 1) % buffer.maxBufferSize;
+	if (sink == nullptr) {
+		return;
+	}
+
+	const bool noteOff = isNoteOff(event);
+	const uint32_t freeEvents = std::min<uint32_t>(MIDI_OUTPUT_CAPACITY - numWrittenEvents, sink->getFreeEvents());
+	const uint32_t reserve = noteOff ? 0 : MIDI_NOTE_OFF_RESERVE;
+
+	if (freeEvents > reserve && sink->writeEvent(event)) {
+		numWrittenEvents++;
+		return;
+	}
+
+	droppedEvents++;
+	if (noteOff) {
+		droppedNoteOffs++;
+	}
 }
 
-void MidiHandler::mergeBuffers()
+// events from the source go before the appended ones on the same frame
+void MidiHandler::writeSourceEvents(uint32_t frame)
 {
-	for (unsigned e = 0; e < buffer.numBufferedThroughEvents; e++) {
-		buffer.bufferedEvents[e + buffer.numBufferedEvents] = buffer.bufferedMidiThroughEvents[e];
+	if (source == nullptr) {
+		return;
 	}
+
+	const MidiEvent* event;
+	while ((event = source->peekEvent()) != nullptr && event->frame <= frame) {
+		writeEvent(*event);
+		source->popEvent();
+	}
+}
+
+// events have to come in frame order
+void MidiHandler::appendMidiMessage(const MidiEvent& event)
+{
+	writeSourceEvents(event.frame);
+	writeEvent(event);
+}
+
+// what the source still has for the block
+void MidiHandler::flush()
+{
+	writeSourceEvents(UINT32_MAX);
+}
+
+uint32_t MidiHandler::getDroppedEvents() const
+{
+	return droppedEvents;
+}
+
+uint32_t MidiHandler::getDroppedNoteOffs() const
+{
+	return droppedNoteOffs;
 }
 
-struct MidiBuffer MidiHandler::getMidiBuffer()
+void MidiHandler::resetDroppedEvents()
 {
-	mergeBuffers();
-	return buffer;
+	droppedEvents = 0;
+	droppedNoteOffs = 0;
 }
@@ -5,9 +5,16 @@
 
 #include <cstdint>
 
-#define MIDI_BUFFER_SIZE 2048
 #define EMPTY_SLOT 200
 
+// events written in one block at most, the last ones are kept for note-offs
+// so nothing is left hanging when there are too many. The output port asks
+// the host for room for all of them, an LV2 MIDI event takes 24 bytes.
+#define MIDI_OUTPUT_CAPACITY 2048
+#define MIDI_NOTE_OFF_RESERVE 256
+#define MIDI_OUTPUT_EVENT_SIZE 24
+#define MIDI_OUTPUT_BUFFER_SIZE (MIDI_OUTPUT_CAPACITY * MIDI_OUTPUT_EVENT_SIZE)
+
 #define MIDI_NOTEOFF 0x80
 #define MIDI_NOTEON  0x90
 #define MIDI_SYSTEM_EXCLUSIVE 0xF0
@@ -27,33 +34,48 @@
 #define MIDI_ACTIVE_SENSING 0xFE
 #define MIDI_SYSTEM_RESET 0xFF
 
-struct MidiBuffer {
-	unsigned maxBufferSize = MIDI_BUFFER_SIZE;
-
-	MidiEvent bufferedEvents[MIDI_BUFFER_SIZE];
-	unsigned numBufferedEvents;
-
-	MidiEvent bufferedMidiThroughEvents[MIDI_BUFFER_SIZE];
-	unsigned numBufferedThroughEvents;
+// events that are made while the output is written instead of being
+// handed over, in frame order
+class MidiEventSource {
+public:
+	virtual ~MidiEventSource() {}
+	virtual const MidiEvent* peekEvent() = 0;
+	virtual void popEvent() = 0;
+};
 
-	MidiEvent midiOutputBuffer[MIDI_BUFFER_SIZE];
-	unsigned numOutputEvents;
+// where the output goes as it is made, in frame order. An event that does
+// not fit is refused, a sink with less room than the handler allows says how
+// many more events fit so the note-offs keep their share of it.
+class MidiEventSink {
+public:
+	virtual ~MidiEventSink() {}
+	virtual bool writeEvent(const MidiEvent& event) = 0;
+	virtual uint32_t getFreeEvents() const { return UINT32_MAX; }
 };
 
+// writes events to the sink as they come, with the ones from the source
+// that are due by then in between. What does not fit is dropped and counted.
 class MidiHandler {
 public:
 	MidiHandler();
 	~MidiHandler();
-	void emptyMidiBuffer();
-	void appendMidiMessage(MidiEvent event);
-	void appendMidiThroughMessage(MidiEvent event);
-	void resetBuffer();
-	int getNumEvents();
-	void mergeBuffers();
-	//MidiEvent getMidiEvent(int index);
-	struct MidiBuffer getMidiBuffer();
+	void setSink(MidiEventSink* sink);
+	void setSource(MidiEventSource* source);
+	void nextBlock();
+	void appendMidiMessage(const MidiEvent& event);
+	void flush();
+	uint32_t getDroppedEvents() const;
+	uint32_t getDroppedNoteOffs() const;
+	void resetDroppedEvents();
 private:
-	MidiBuffer buffer;
+	void writeSourceEvents(uint32_t frame);
+	void writeEvent(const MidiEvent& event);
+
+	MidiEventSink* sink;
+	MidiEventSource* source;
+	uint32_t numWrittenEvents;
+	uint32_t droppedEvents;
+	uint32_t droppedNoteOffs;
 };
 
 #endif //_H_MIDI_HANDLER_
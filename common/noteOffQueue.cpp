@@ -0,0 +1,136 @@
+#include "noteOffQueue.hpp"
+
+#include <cstring>
+
+NoteOffQueue::NoteOffQueue()
+{
+	size = 0;
+	memset(heapIndex, NOT_QUEUED, sizeof(heapIndex));
+}
+
+NoteOffQueue::~NoteOffQueue()
+{
+}
+
+void NoteOffQueue::clear()
+{
+	for (int i = 0; i < size; i++) {
+		heapIndex[heap[i].channel][heap[i].note] = NOT_QUEUED;
+	}
+	size = 0;
+}
+
+bool NoteOffQueue::isEmpty() const
+{
+	return size == 0;
+}
+
+bool NoteOffQueue::isFull() const
+{
+	return size == NOTE_OFF_QUEUE_SIZE;
+}
+
+bool NoteOffQueue::isPending(uint8_t note, uint8_t channel) const
+{
+	return heapIndex[channel & 0x0F][note & 0x7F] != NOT_QUEUED;
+}
+
+uint64_t NoteOffQueue::getNextDeadline() const
+{
+	return (size > 0) ? heap[0].deadline : UINT64_MAX;
+}
+
+// the caller makes room with popNext() when the queue is full
+void NoteOffQueue::schedule(uint8_t note, uint8_t channel, uint64_t deadline)
+{
+	note &= 0x7F;
+	channel &= 0x0F;
+
+	const uint8_t index = heapIndex[channel][note];
+
+	if (index != NOT_QUEUED) {
+		if (deadline > heap[index].deadline) {
+			heap[index].deadline = deadline;
+			siftDown(index);
+		}
+		return;
+	}
+
+	if (size == NOTE_OFF_QUEUE_SIZE) {
+		return;
+	}
+
+	NoteOff noteOff;
+	noteOff.deadline = deadline;
+	noteOff.note = note;
+	noteOff.channel = channel;
+
+	place(size++, noteOff);
+	siftUp(size - 1);
+}
+
+bool NoteOffQueue::popDue(uint64_t frame, NoteOff& noteOff)
+{
+	if (size == 0 || heap[0].deadline > frame) {
+		return false;
+	}
+
+	popNext(noteOff);
+
+	return true;
+}
+
+void NoteOffQueue::popNext(NoteOff& noteOff)
+{
+	noteOff = heap[0];
+	heapIndex[noteOff.channel][noteOff.note] = NOT_QUEUED;
+
+	if (--size > 0) {
+		place(0, heap[size]);
+		siftDown(0);
+	}
+}
+
+void NoteOffQueue::place(int index, const NoteOff& noteOff)
+{
+	heap[index] = noteOff;
+	heapIndex[noteOff.channel][noteOff.note] = static_cast<uint8_t>(index);
+}
+
+void NoteOffQueue::siftUp(int index)
+{
+	const NoteOff noteOff = heap[index];
+
+	while (index > 0) {
+		const int parent = (index - 1) / 2;
+		if (heap[parent].deadline <= noteOff.deadline) {
+			break;
+		}
+		place(index, heap[parent]);
+		index = parent;
+	}
+
+	place(index, noteOff);
+}
+
+void NoteOffQueue::siftDown(int index)
+{
+	const NoteOff noteOff = heap[index];
+
+	while (true) {
+		int child = 2 * index + 1;
+		if (child >= size) {
+			break;
+		}
+		if (child + 1 < size && heap[child + 1].deadline < heap[child].deadline) {
+			child++;
+		}
+		if (noteOff.deadline <= heap[child].deadline) {
+			break;
+		}
+		place(index, heap[child]);
+		index = child;
+	}
+
+	place(index, noteOff);
+}
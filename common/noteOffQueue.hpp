@@ -0,0 +1,42 @@
+#ifndef _H_NOTE_OFF_QUEUE_
+#define _H_NOTE_OFF_QUEUE_
+
+#include <cstdint>
+
+#define NOTE_OFF_QUEUE_SIZE 128
+#define NOTE_OFF_NUM_CHANNELS 16
+#define NOTE_OFF_NUM_NOTES 128
+#define NOT_QUEUED 0xFF
+
+struct NoteOff {
+	uint64_t deadline;
+	uint8_t note;
+	uint8_t channel;
+};
+
+// Pending note-offs as a min-heap on their absolute frame deadline.
+// A note and channel is queued at most once, scheduling it again ties the
+// two notes together by moving the deadline.
+class NoteOffQueue {
+public:
+	NoteOffQueue();
+	~NoteOffQueue();
+	void clear();
+	bool isEmpty() const;
+	bool isFull() const;
+	bool isPending(uint8_t note, uint8_t channel) const;
+	uint64_t getNextDeadline() const;
+	void schedule(uint8_t note, uint8_t channel, uint64_t deadline);
+	bool popDue(uint64_t frame, NoteOff& noteOff);
+	void popNext(NoteOff& noteOff);
+private:
+	void place(int index, const NoteOff& noteOff);
+	void siftUp(int index);
+	void siftDown(int index);
+
+	NoteOff heap[NOTE_OFF_QUEUE_SIZE];
+	int size;
+	uint8_t heapIndex[NOTE_OFF_NUM_CHANNELS][NOTE_OFF_NUM_NOTES];
+};
+
+#endif //_H_NOTE_OFF_QUEUE_
@@ -1,6 +1,8 @@
 #include "pattern.hpp"
 
-Pattern::Pattern() : size(1), step(0), range(1)
+#include <string.h>
+
+Pattern::Pattern() : type(PATTERN_UP), numValues(0), length(0), position(0), cycleLength(1)
 {
 }
 
@@ -8,235 +10,180 @@ Pattern::~Pattern()
 {
 }
 
-void Pattern::setPatternSize(int size)
+// keeps the position, so a mode change carries on from the same step
+void Pattern::setType(PatternType type)
 {
-	this->size = size;
+	this->type = type;
+	build();
 }
 
-void Pattern::setStep(int step)
+void Pattern::setValues(const uint8_t* values, int numValues)
 {
-	this->step = step;
+	this->numValues = (numValues < PATTERN_MAX_VALUES) ? numValues : PATTERN_MAX_VALUES;
+	memcpy(this->values, values, this->numValues);
+	build();
 }
 
-void Pattern::setCycleRange(int range)
+void Pattern::insertValue(int index, uint8_t value)
 {
-	this->range = range;
-}
+	if (numValues >= PATTERN_MAX_VALUES || index < 0 || index > numValues) {
+		return;
+	}
 
-int Pattern::getSize()
-{
-	return size;
-}
+	Run runs[PATTERN_MAX_RUNS];
+	const int numRuns = getRuns(numValues, runs);
 
-int Pattern::getStep()
-{
-	return step;
-}
+	// a run only grows by the new value when its ends stay where they were,
+	// otherwise (like a new lowest note in up-down) the whole thing is rebuilt
+	bool splice = (type != PATTERN_CYCLE && length + numRuns <= PATTERN_MAX_LENGTH);
+	for (int r = 0; r < numRuns; r++) {
+		if (index < runs[r].first || index > runs[r].last + 1) {
+			splice = false;
+		}
+	}
 
-int Pattern::getDirection()
-{
-	return direction;
-}
+	memmove(values + index + 1, values + index, numValues - index);
+	values[index] = value;
+	numValues++;
 
-PatternUp::PatternUp()
-{
-	reset();
-}
+	if (!splice) {
+		build();
+		return;
+	}
 
-PatternUp::~PatternUp()
-{
+	int runOffset = length;
+	for (int r = numRuns - 1; r >= 0; r--) {
+		runOffset -= runs[r].last - runs[r].first + 1;
+		const int offset = runs[r].reverse ? runOffset + runs[r].last + 1 - index : runOffset + index - runs[r].first;
+		insertStep(offset, value);
+	}
 }
 
-void PatternUp::setDirection(int direction)
+void Pattern::removeValue(int index)
 {
-	this->direction = abs(direction);
-}
+	if (index < 0 || index >= numValues) {
+		return;
+	}
 
-void PatternUp::reset()
-{
-	step = 0;
-	direction = 1;
-}
+	Run runs[PATTERN_MAX_RUNS];
+	const int numRuns = getRuns(numValues, runs);
 
-void PatternUp::goToNextStep()
-{
-	if (size > 0) {
-		step = (step + 1) % size;
-	} else {
-		step = 0;
+	bool splice = (type != PATTERN_CYCLE);
+	for (int r = 0; r < numRuns; r++) {
+		if (index < runs[r].first || index > runs[r].last) {
+			splice = false;
+		}
 	}
-}
-
-PatternDown::PatternDown()
-{
-	reset();
-}
 
-PatternDown::~PatternDown()
-{
-}
+	memmove(values + index, values + index + 1, numValues - index - 1);
+	numValues--;
 
-void PatternDown::setDirection(int direction)
-{
-	this->direction = abs(direction) * -1;
-}
+	if (!splice) {
+		build();
+		return;
+	}
 
-void PatternDown::reset()
-{
-	step = 0;
-	direction = -1;
-}
+	int runOffset = length;
+	for (int r = numRuns - 1; r >= 0; r--) {
+		runOffset -= runs[r].last - runs[r].first + 1;
+		const int offset = runs[r].reverse ? runOffset + runs[r].last - index : runOffset + index - runs[r].first;
+		removeStep(offset);
+	}
 
-void PatternDown::goToNextStep()
-{
-	if (size > 0) {
-		step = (step + direction < 0) ? size - 1 : step + direction;
-	} else {
-		step = 0;
+	if (position >= length) {
+		position = 0;
 	}
 }
 
-PatternUpDown::PatternUpDown()
+// how many times each value repeats in a cycle pattern
+void Pattern::setCycleLength(int cycleLength)
 {
-	reset();
-}
+	cycleLength = (cycleLength > 1) ? cycleLength : 1;
 
-PatternUpDown::~PatternUpDown()
-{
+	if (cycleLength != this->cycleLength) {
+		this->cycleLength = cycleLength;
+		if (type == PATTERN_CYCLE) {
+			build();
+		}
+	}
 }
 
-void PatternUpDown::setDirection(int direction)
+// the random type draws from this, the same seed plays the same sequence
+void Pattern::setSeed(uint32_t seed)
 {
-	this->direction = direction;
+	random.setSeed(seed);
 }
 
-void PatternUpDown::reset()
+void Pattern::reset()
 {
-	step = 0;
-	direction = 1;
+	position = 0;
 }
 
-void PatternUpDown::goToNextStep()
+// the value index ranges a type plays, in order, for a list of numValues
+int Pattern::getRuns(int numValues, Run* runs) const
 {
-	if (size > 1) {
-		int nextStep = step + direction;
-		direction = (nextStep >= size) ? -1 : direction;
-		direction = (nextStep < 0) ? 1 : direction;
-		step += direction;
-	} else {
-		step = 0;
-	}
-}
+	const int last = numValues - 1;
 
-PatternUpDownAlt::PatternUpDownAlt()
-{
-	reset();
+	switch (type)
+	{
+		case PATTERN_DOWN:
+			runs[0] = {0, last, true};
+			return 1;
+		case PATTERN_UP_DOWN:
+			runs[0] = {0, last, false};
+			runs[1] = {1, last - 1, true};
+			return 2;
+		case PATTERN_UP_DOWN_ALT:
+			runs[0] = {0, last, false};
+			runs[1] = {0, last, true};
+			return 2;
+		default:
+			runs[0] = {0, last, false};
+			return 1;
+	}
 }
 
-PatternUpDownAlt::~PatternUpDownAlt()
+void Pattern::build()
 {
-}
+	Run runs[PATTERN_MAX_RUNS];
+	const int numRuns = getRuns(numValues, runs);
+	const int repeat = (type == PATTERN_CYCLE) ? cycleLength : 1;
 
-void PatternUpDownAlt::setDirection(int direction)
-{
-	this->direction = direction;
-}
+	length = 0;
 
-void PatternUpDownAlt::reset()
-{
-	step = 0;
-	direction = 1;
-	checked = false;
-	skip = false;
-}
+	for (int r = 0; r < numRuns; r++) {
+		for (int i = 0; i <= runs[r].last - runs[r].first; i++) {
+			const int index = runs[r].reverse ? runs[r].last - i : runs[r].first + i;
 
-void PatternUpDownAlt::goToNextStep()
-{
-	if (size > 1) {
-		int nextStep = step + direction;
-
-		if (!checked) {
-			if (nextStep >= size) {
-				direction = -1;
-				skip = true;
-				checked = true;
+			for (int n = 0; n < repeat && length < PATTERN_MAX_LENGTH; n++) {
+				sequence[length++] = values[index];
 			}
-			if (nextStep < 0) {
-				direction = 1;
-				skip = true;
-				checked = true;
-			}
-		}
-
-		if (!skip) {
-			step += direction;
-			checked = false;
 		}
-		skip = false;
-	} else {
-		step = 0;
-		//TODO init other values
 	}
-}
-
-PatternRandom::PatternRandom()
-{
-	reset();
-}
-
-PatternRandom::~PatternRandom()
-{
-}
 
-void PatternRandom::setDirection(int direction)
-{
-	this->direction = direction;
-}
-
-void PatternRandom::reset()
-{
-	goToNextStep();
-}
-
-void PatternRandom::goToNextStep()
-{
-    step = rand() % size;
-}
-
-PatternCycle::PatternCycle()
-{
-	reset();
-}
-
-PatternCycle::~PatternCycle()
-{
+	if (position >= length) {
+		position = 0;
+	}
 }
 
-void PatternCycle::setDirection(int direction)
+// steps already played this time around keep the next step in place
+void Pattern::insertStep(int offset, uint8_t value)
 {
-	this->direction = abs(direction);
-}
+	memmove(sequence + offset + 1, sequence + offset, length - offset);
+	sequence[offset] = value;
+	length++;
 
-void PatternCycle::reset()
-{
-	step = 0;
-	tempStep = 0;
-	direction = 1;
+	if (offset < position) {
+		position++;
+	}
 }
 
-void PatternCycle::goToNextStep()
+void Pattern::removeStep(int offset)
 {
-	if (size >= 1) {
-		int nextStep = tempStep + direction;
+	memmove(sequence + offset, sequence + offset + 1, length - offset - 1);
+	length--;
 
-		if (range > 0 && size > 0) {
-			if (nextStep >= size) {
-				step = (step + 1) % range;
-			}
-			tempStep = (tempStep + direction) % size;
-		}
-	} else {
-		step = 0;
-		tempStep = 0;
+	if (offset < position) {
+		position--;
 	}
 }
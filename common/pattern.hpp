@@ -1,93 +1,99 @@
 #ifndef _H_PATTERN_
 #define _H_PATTERN_
 
-#include <stdlib.h>
-#include <time.h>
+#include <cstdint>
 
-class Pattern {
+#include "randomGenerator.hpp"
+
+#define PATTERN_MAX_VALUES 32
+#define PATTERN_MAX_LENGTH 256
+#define PATTERN_MAX_RUNS 2
 
-enum {
-	ARP_UP = 0,
-	ARP_DOWN
+enum PatternType {
+	PATTERN_UP = 0,
+	PATTERN_DOWN,
+	PATTERN_UP_DOWN,
+	PATTERN_UP_DOWN_ALT,
+	PATTERN_RANDOM,
+	PATTERN_CYCLE
 };
 
+// A list of values (held notes, octave offsets) flattened into the order a
+// pattern type plays them in, so each step is a load and an index increment.
+// Every type is one or two runs over the value list, forwards or backwards,
+// so adding or removing a value splices the runs in place.
+class Pattern {
 public:
 	Pattern();
-	virtual ~Pattern();
-	void setPatternSize(int size);
-	void setStep(int step);
-	void setCycleRange(int range);
-	int getSize();
-	int getStepSize();
-	int getStep();
-	int getDirection();
-	virtual void setDirection(int direction) = 0;
-	virtual void reset() = 0;
-	virtual void goToNextStep() = 0;
-protected:
-	int size;
-	int step;
-	int direction;
-	int range;
-};
+	~Pattern();
+	void setType(PatternType type);
+	void setValues(const uint8_t* values, int numValues);
+	void insertValue(int index, uint8_t value);
+	void removeValue(int index);
+	void setCycleLength(int cycleLength);
+	void setSeed(uint32_t seed);
+	PatternType getType() const;
+	int getNumValues() const;
+	int getLength() const;
+	bool isEmpty() const;
+	void reset();
+	uint8_t getNextValue();
+private:
+	struct Run {
+		int first;
+		int last;
+		bool reverse;
+	};
 
-class PatternUp : public Pattern {
-public:
-	PatternUp();
-	~PatternUp();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
-};
+	int getRuns(int numValues, Run* runs) const;
+	void build();
+	void insertStep(int offset, uint8_t value);
+	void removeStep(int offset);
 
-class PatternDown : public Pattern {
-public:
-	PatternDown();
-	~PatternDown();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
+	PatternType type;
+	uint8_t values[PATTERN_MAX_VALUES];
+	int numValues;
+	uint8_t sequence[PATTERN_MAX_LENGTH];
+	int length;
+	int position;
+	int cycleLength;
+	RandomGenerator random;
 };
 
-class PatternUpDown : public Pattern {
-public:
-	PatternUpDown();
-	~PatternUpDown();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
-};
+inline PatternType Pattern::getType() const
+{
+	return type;
+}
 
-class PatternUpDownAlt : public Pattern {
-public:
-	PatternUpDownAlt();
-	~PatternUpDownAlt();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
-private:
-	bool checked;
-	bool skip;
-};
+inline int Pattern::getNumValues() const
+{
+	return numValues;
+}
 
-class PatternRandom : public Pattern {
-public:
-	PatternRandom();
-	~PatternRandom();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
-};
+inline int Pattern::getLength() const
+{
+	return length;
+}
 
-class PatternCycle : public Pattern {
-public:
-	PatternCycle();
-	~PatternCycle();
-	void setDirection(int direction) override;
-	void reset() override;
-	void goToNextStep() override;
-private:
-	int tempStep;
-};
+inline bool Pattern::isEmpty() const
+{
+	return length == 0;
+}
+
+// 0 when the pattern is empty
+inline uint8_t Pattern::getNextValue()
+{
+	if (length == 0) {
+		return 0;
+	}
+	if (type == PATTERN_RANDOM) {
+		position = static_cast<int>(random.getRange(length));
+	}
+
+	const uint8_t value = sequence[position];
+	position = (position + 1 < length) ? position + 1 : 0;
+
+	return value;
+}
 
 #endif // _H_PATTERN_
@@ -0,0 +1,23 @@
+#include "randomGenerator.hpp"
+
+RandomGenerator::RandomGenerator()
+{
+	setSeed(DEFAULT_RANDOM_SEED);
+}
+
+RandomGenerator::~RandomGenerator()
+{
+}
+
+// xorshift gets stuck on a zero state, so the seed is mixed into one that never is
+void RandomGenerator::setSeed(uint32_t seed)
+{
+	state = seed ^ DEFAULT_RANDOM_SEED;
+	state = (state ^ (state >> 16)) * 0x45D9F3B;
+	state = (state ^ (state >> 16)) * 0x45D9F3B;
+	state = state ^ (state >> 16);
+
+	if (state == 0) {
+		state = DEFAULT_RANDOM_SEED;
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef _H_RANDOM_GENERATOR_
+#define _H_RANDOM_GENERATOR_
+
+#include <cstdint>
+
+#define DEFAULT_RANDOM_SEED 0x9E3779B9
+
+// Small xorshift generator, one per instance. It never locks or allocates and
+// the same seed always gives the same sequence.
+class RandomGenerator {
+public:
+	RandomGenerator();
+	~RandomGenerator();
+	void setSeed(uint32_t seed);
+	uint32_t getNext();
+	uint32_t getRange(uint32_t range);
+private:
+	uint32_t state;
+};
+
+inline uint32_t RandomGenerator::getNext()
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+// a value below range, 0 when the range is empty
+inline uint32_t RandomGenerator::getRange(uint32_t range)
+{
+	return static_cast<uint32_t>((static_cast<uint64_t>(getNext()) * range) >> 32);
+}
+
+#endif //_H_RANDOM_GENERATOR_
@@ -1,59 +1,43 @@
 #include "arpeggiator.hpp"
 
+#include <algorithm>
+#include <ctime>
+
+static const PatternType arpPatternTypes[NUM_ARP_MODES] = {
+	PATTERN_UP, PATTERN_DOWN, PATTERN_UP_DOWN, PATTERN_UP_DOWN_ALT, PATTERN_UP, PATTERN_RANDOM
+};
+
+static const PatternType octavePatternTypes[NUM_OCTAVE_MODES] = {
+	PATTERN_UP, PATTERN_DOWN, PATTERN_UP_DOWN, PATTERN_UP_DOWN_ALT, PATTERN_CYCLE
+};
+
 Arpeggiator::Arpeggiator()
 {
-	clock.transmitHostInfo(0, 4, 1, 1, 120.0);
+	clock.transmitHostInfo(TimePosition());
 	clock.setSampleRate(static_cast<float>(48000.0));
 	clock.setDivision(7);
 
-	arpPattern = new Pattern*[6];
-
-	arpPattern[0] = new PatternUp();
-	arpPattern[1] = new PatternDown();
-	arpPattern[2] = new PatternUpDown();
-	arpPattern[3] = new PatternUpDownAlt();
-	arpPattern[4] = new PatternUp();
-	arpPattern[5] = new PatternRandom();
+	midiHandler.setSource(&clockSender);
 
+	for (unsigned i = 0; i < NUM_VOICES; i++) {
+		midiNotesBypassed[i] = EMPTY_SLOT;
+	}
 
-	octavePattern = new Pattern*[5];
+	updateOctavePattern();
 
-	octavePattern[0] = new PatternUp();
-	octavePattern[1] = new PatternDown();
-	octavePattern[2] = new PatternUpDown();
-	octavePattern[3] = new PatternUpDownAlt();
-	octavePattern[4] = new PatternCycle();
+	instanceSeed = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this)) ^ static_cast<uint32_t>(time(nullptr));
+	arpPattern.setSeed(getInstanceSeed());
+}
 
-	for (unsigned i = 0; i < NUM_VOICES; i++) {
-		midiNotes[i][0] = EMPTY_SLOT;
-		midiNotes[i][1] = 0;
-	}
-	for (unsigned i = 0; i < NUM_VOICES; i++) {
-		noteOffBuffer[i][MIDI_NOTE] = EMPTY_SLOT;
-		noteOffBuffer[i][MIDI_CHANNEL] = 0;
-		noteOffBuffer[i][TIMER] = 0;
-	}
+// unseeded instances must not all play the same random sequence. The entropy
+// is taken once in the constructor, seed changes can come in on the audio thread.
+uint32_t Arpeggiator::getInstanceSeed()
+{
+	return instanceSeed + 0x9E3779B9u * numInstanceSeeds++;
 }
 
 Arpeggiator::~Arpeggiator()
 {
-
-	delete arpPattern[0];
-	delete arpPattern[1];
-	delete arpPattern[2];
-	delete arpPattern[3];
-	delete arpPattern[4];
-	delete arpPattern[5];
-	delete octavePattern[0];
-	delete octavePattern[1];
-	delete octavePattern[2];
-	delete octavePattern[3];
-	delete octavePattern[4];
-
-	delete[] arpPattern;
-	arpPattern = nullptr;
-	delete[] octavePattern;
-	octavePattern = nullptr;
 }
 
 void Arpeggiator::setArpEnabled(bool arpEnabled)
@@ -90,6 +74,10 @@ void Arpeggiator::setSyncMode(int mode)
 			clock.setSyncMode(HOST_QUANTIZED_SYNC);
 			quantizedStart = true;
 			break;
+		case MIDI_CLOCK_SYNC:
+			clock.setSyncMode(MIDI_CLOCK_SYNC);
+			quantizedStart = true;
+			break;
 	}
 }
 
@@ -121,22 +109,28 @@ void Arpeggiator::setNoteLength(float noteLength)
 
 void Arpeggiator::setOctaveSpread(int octaveSpread)
 {
-	this->octaveSpread = octaveSpread;
+	if (octaveSpread != this->octaveSpread) {
+		this->octaveSpread = octaveSpread;
+		updateOctavePattern();
+	}
 }
 
 void Arpeggiator::setArpMode(int arpMode)
 {
-	arpPattern[arpMode]->setStep(arpPattern[this->arpMode]->getStep());
-	arpPattern[arpMode]->setDirection(arpPattern[this->arpMode]->getDirection());
+	arpPattern.setType(arpPatternTypes[arpMode]);
 
+	const bool playedOrderChanged = (arpMode == ARP_PLAYED) != (this->arpMode == ARP_PLAYED);
 	this->arpMode = arpMode;
+
+	if (playedOrderChanged) {
+		updateArpPattern();
+	}
+	octavePattern.setCycleLength(arpPattern.getLength());
 }
 
 void Arpeggiator::setOctaveMode(int octaveMode)
 {
-	octavePattern[octaveMode]->setStep(octavePattern[this->octaveMode]->getStep());
-	octavePattern[octaveMode]->setDirection(octavePattern[this->octaveMode]->getDirection());
-
+	octavePattern.setType(octavePatternTypes[octaveMode]);
 	this->octaveMode = octaveMode;
 }
 
@@ -145,6 +139,66 @@ void Arpeggiator::setPanic(bool panic)
 	this->panic = panic;
 }
 
+// 0 keeps the random mode unseeded, anything else replays the same sequence from every reset
+void Arpeggiator::setSeed(int seed)
+{
+	if (seed != this->seed) {
+		this->seed = seed;
+		arpPattern.setSeed((seed != 0) ? static_cast<uint32_t>(seed) : getInstanceSeed());
+	}
+}
+
+void Arpeggiator::setClockOutput(bool clockOutput)
+{
+	clockSender.setEnabled(clockOutput);
+}
+
+void Arpeggiator::setSwing(float swing)
+{
+	if (swing != this->swing) {
+		clock.setSwing(swing);
+		this->swing = swing;
+	}
+}
+
+void Arpeggiator::setGroove(int groove)
+{
+	if (groove != this->groove && groove >= 0 && groove < NUM_GROOVE_TEMPLATES) {
+		clock.setGroove(grooveTemplates[groove]);
+		this->groove = groove;
+	}
+}
+
+// a groove of its own instead of one of the templates
+void Arpeggiator::setGrooveTemplate(const GrooveTemplate& groove)
+{
+	clock.setGroove(groove);
+	this->groove = -1;
+}
+
+// what a loop or a seek of the host does to the pattern
+void Arpeggiator::setRestartMode(int restartMode)
+{
+	if (restartMode >= 0 && restartMode < NUM_RESTART_MODES) {
+		this->restartMode = restartMode;
+	}
+}
+
+// how the first note of a phrase starts, after a window for the rest of the
+// chord, as soon as it is played, or on the next step of the grid
+void Arpeggiator::setFirstNoteMode(int firstNoteMode)
+{
+	if (firstNoteMode >= 0 && firstNoteMode < NUM_FIRST_NOTE_MODES) {
+		this->firstNoteMode = firstNoteMode;
+	}
+}
+
+// in milliseconds
+void Arpeggiator::setChordWindow(float chordWindow)
+{
+	this->chordWindow = std::max(chordWindow, 0.f);
+}
+
 bool Arpeggiator::getArpEnabled() const
 {
 	return arpEnabled;
@@ -205,28 +259,75 @@ bool Arpeggiator::getPanic() const
 	return panic;
 }
 
-void Arpeggiator::transmitHostInfo(const bool playing, const float beatsPerBar,
-		const int beat, const float barBeat, const double bpm)
+int Arpeggiator::getSeed() const
+{
+	return seed;
+}
+
+bool Arpeggiator::getClockOutput() const
+{
+	return clockSender.getEnabled();
+}
+
+float Arpeggiator::getSwing() const
+{
+	return swing;
+}
+
+int Arpeggiator::getGroove() const
+{
+	return groove;
+}
+
+int Arpeggiator::getRestartMode() const
+{
+	return restartMode;
+}
+
+int Arpeggiator::getFirstNoteMode() const
 {
-	clock.transmitHostInfo(playing, beatsPerBar, beat, barBeat, bpm);
-	this->barBeat = barBeat;
+	return firstNoteMode;
+}
+
+float Arpeggiator::getChordWindow() const
+{
+	return chordWindow;
+}
+
+uint32_t Arpeggiator::getDroppedEvents() const
+{
+	return midiHandler.getDroppedEvents();
+}
+
+uint32_t Arpeggiator::getDroppedNoteOffs() const
+{
+	return midiHandler.getDroppedNoteOffs();
+}
+
+void Arpeggiator::resetDroppedEvents()
+{
+	midiHandler.resetDroppedEvents();
+}
+
+#ifdef CLOCK_INSTRUMENTATION
+void Arpeggiator::setGateLog(GateLog* gateLog)
+{
+	clock.setGateLog(gateLog);
+}
+#endif
+
+void Arpeggiator::transmitHostInfo(const TimePosition& position)
+{
+	clock.transmitHostInfo(position);
 }
 
 void Arpeggiator::reset()
 {
 	clock.reset();
-	clock.setNumBarsElapsed(0);
 
-	for (unsigned a = 0; a < NUM_ARP_MODES; a++) {
-		arpPattern[arpMode]->reset();
-	}
-	for (unsigned o = 0; o < NUM_OCTAVE_MODES; o++) {
-		octavePattern[o]->reset();
-	}
+	resetPatterns();
 
-	activeNotesIndex = 0;
-	firstNoteTimer  = 0;
-	notePlayed = 0;
+	firstNoteDeadline = UINT64_MAX;
 	activeNotes = 0;
 	//previousLatch = 0;
 	notesPressed = 0;
@@ -235,252 +336,356 @@ void Arpeggiator::reset()
 	firstNote = false;
 	first = true;
 
-	for (unsigned i = 0; i < NUM_VOICES; i++) {
-		midiNotes[i][MIDI_NOTE] = EMPTY_SLOT;
-		midiNotes[i][MIDI_CHANNEL] = 0;
+	keyboard.clear();
+	updateArpPattern();
+}
+
+void Arpeggiator::setEventSink(MidiEventSink* sink)
+{
+	midiHandler.setSink(sink);
+}
+
+// back to the first step, a seeded random mode also restarts its sequence
+void Arpeggiator::resetPatterns()
+{
+	arpPattern.reset();
+	octavePattern.reset();
+
+	if (seed != 0) {
+		arpPattern.setSeed(static_cast<uint32_t>(seed));
 	}
 }
 
-void Arpeggiator::emptyMidiBuffer()
+// the notes the arp pattern plays, in pitch order or in the order they were played
+void Arpeggiator::updateArpPattern()
 {
-	midiHandler.emptyMidiBuffer();
+	uint8_t notes[NUM_VOICES];
+	int numNotes;
+
+	if (arpMode == ARP_PLAYED) {
+		numNotes = keyboard.getPlayedNotes(notes, NUM_VOICES);
+	} else {
+		numNotes = keyboard.getSortedNotes(notes, NUM_VOICES);
+	}
+
+	arpPattern.setValues(notes, numNotes);
+	octavePattern.setCycleLength(arpPattern.getLength());
 }
 
-struct MidiBuffer Arpeggiator::getMidiBuffer()
+void Arpeggiator::updateOctavePattern()
 {
-	return midiHandler.getMidiBuffer();
+	uint8_t octaves[MAX_OCTAVE_SPREAD];
+	const int numOctaves = std::max(1, std::min(octaveSpread, MAX_OCTAVE_SPREAD));
+
+	for (int o = 0; o < numOctaves; o++) {
+		octaves[o] = static_cast<uint8_t>(o * 12);
+	}
+
+	octavePattern.setValues(octaves, numOctaves);
 }
 
-void Arpeggiator::process(const MidiEvent* events, uint32_t eventCount, uint32_t n_frames)
+// call after the note was added to the keyboard
+void Arpeggiator::insertNote(uint8_t note)
 {
-	struct MidiEvent midiEvent;
-	struct MidiEvent midiThroughEvent;
+	const int index = (arpMode == ARP_PLAYED) ? keyboard.getNumNotes() - 1 : keyboard.getSortedIndex(note);
 
-	if (!latchMode && previousLatch && notesPressed <= 0) {
-		reset();
+	arpPattern.insertValue(index, note);
+	octavePattern.setCycleLength(arpPattern.getLength());
+}
+
+// call before the note is taken off the keyboard
+void Arpeggiator::removeNote(uint8_t note)
+{
+	if (!keyboard.isHeld(note)) {
+		return;
 	}
-	if (latchMode != previousLatch) {
-		previousLatch = latchMode;
+
+	const int index = (arpMode == ARP_PLAYED) ? keyboard.getPlayedIndex(note) : keyboard.getSortedIndex(note);
+
+	arpPattern.removeValue(index);
+	octavePattern.setCycleLength(arpPattern.getLength());
+}
+
+// frames after the current one in which no gate, note-off or first note is due
+uint32_t Arpeggiator::getIdleFrames(uint32_t maxFrames) const
+{
+	uint32_t idleFrames = maxFrames;
+	const uint64_t nextFrame = frameCount + 1;
+
+	if (first && clock.getSyncMode() <= 1) {
+		// the clock is held at the start of a period, the gate opens on every frame
+		if (firstNoteDeadline <= nextFrame) {
+			return 0;
+		}
+		idleFrames = static_cast<uint32_t>(std::min<uint64_t>(idleFrames, firstNoteDeadline - nextFrame));
+	} else {
+		idleFrames = std::min(idleFrames, clock.getFramesUntilGate());
+
+		if (firstNote && firstNoteMode == FIRST_NOTE_IMMEDIATE && firstNoteDeadline > frameCount) {
+			idleFrames = static_cast<uint32_t>(std::min<uint64_t>(idleFrames, firstNoteDeadline - nextFrame));
+		}
 	}
 
-	if (panic) {
-		reset();
-		panic = false;
+	if (!noteOffQueue.isEmpty()) {
+		const uint64_t deadline = noteOffQueue.getNextDeadline();
+		idleFrames = (deadline <= nextFrame) ? 0 : static_cast<uint32_t>(std::min<uint64_t>(idleFrames, deadline - nextFrame));
+	}
+
+	return idleFrames;
+}
+
+void Arpeggiator::skipFrames(uint32_t frames)
+{
+	if (frames == 0) {
+		return;
+	}
+
+	// until the first note the clock stands still
+	if (!(first && clock.getSyncMode() <= 1)) {
+		clock.advance(frames);
+	}
+#ifdef CLOCK_INSTRUMENTATION
+	else {
+		clock.logHeldFrames(frames);
 	}
+#endif
 
-	for (uint32_t i=0; i<eventCount; ++i) {
+	frameCount += frames;
+}
 
-		uint8_t status = events[i].data[0] & 0xF0;
+void Arpeggiator::sendNoteOff(const NoteOff& noteOff, uint32_t frame)
+{
+	struct MidiEvent midiEvent;
 
-		uint8_t midiNote = events[i].data[1];
-		uint8_t noteToFind;
-		size_t searchNote;
+	midiEvent.frame = frame;
+	midiEvent.size = 3;
+	midiEvent.data[0] = MIDI_NOTEOFF | noteOff.channel;
+	midiEvent.data[1] = noteOff.note;
+	midiEvent.data[2] = 0;
 
-		if (arpEnabled) {
+	midiHandler.appendMidiMessage(midiEvent);
+}
 
-			midiNotesCopied = false;
+// clock and transport messages are passed on unless the clock output
+// replaces them
+bool Arpeggiator::isReplacedByClockOutput(const MidiEvent& event) const
+{
+	return clockSender.getEnabled() && (event.data[0] == MIDI_SONG_POSITION_POINTER
+			|| (event.data[0] >= MIDI_TIMING_CLOCK && event.data[0] <= MIDI_STOP));
+}
 
-			bool voiceFound;
-			bool pitchFound;
-			size_t findFreeVoice;
-			size_t findActivePitch;
+// a note or any other input, on the frame it came in on
+void Arpeggiator::processEvent(const MidiEvent& event)
+{
+	uint8_t status = event.data[0] & 0xF0;
 
-			if (midiNote == 0x7b && events[i].size == 3) {
-				activeNotes = 0;
-				for (unsigned i = 0; i < NUM_VOICES; i++) {
-					midiNotes[i][0] = EMPTY_SLOT;
-					midiNotes[i][1] = 0;
-				}
-			}
+	uint8_t midiNote = event.data[1];
 
-			uint8_t channel = events[i].data[0] & 0x0F;
-
-			switch(status) {
-				case MIDI_NOTEON:
-					if (activeNotes > NUM_VOICES - 1) {
-						reset();
-					} else {
-						if (notesPressed == 0) {
-							if (!latchPlaying) { //TODO check if there needs to be an exception when using sync
-								octavePattern[octaveMode]->reset();
-								clock.reset();
-								notePlayed = 0;
-								firstNote = true;
-							}
-							if (latchMode) {
-								latchPlaying = true;
-								activeNotes = 0;
-								for (unsigned i = 0; i < NUM_VOICES; i++) {
-									midiNotes[i][MIDI_NOTE] = EMPTY_SLOT;
-									midiNotes[i][MIDI_CHANNEL] = 0;
-								}
-							}
-							resetPattern = true;
-						}
+	if (isReplacedByClockOutput(event)) {
+		return;
+	}
 
-						findFreeVoice = 0;
-						findActivePitch = 0;
-						voiceFound = false;
-						pitchFound = false;
-
-						while (findActivePitch < NUM_VOICES && !pitchFound)
-						{
-							if (midiNotes[findActivePitch][MIDI_NOTE] == (uint32_t)midiNote) {
-								pitchFound = true;
-							}
-							findActivePitch++;
-						}
+	midiNotesCopied = false;
 
-						if (!pitchFound) {
-							while (findFreeVoice < NUM_VOICES && !voiceFound)
-							{
-								if (midiNotes[findFreeVoice][MIDI_NOTE] == EMPTY_SLOT) {
-									midiNotes[findFreeVoice][MIDI_NOTE] = midiNote;
-									midiNotes[findFreeVoice][MIDI_CHANNEL] = channel;
-									voiceFound = true;
-								}
-								findFreeVoice++;
-							}
-							notesPressed++;
-							activeNotes++;
-						}
+	if (midiNote == 0x7b && event.size == 3) {
+		activeNotes = 0;
+		keyboard.clear();
+		updateArpPattern();
+	}
 
-						if (arpMode != ARP_PLAYED)
-							utils.quicksort(midiNotes, 0, NUM_VOICES - 1);
-						if (midiNote < midiNotes[notePlayed - 1][MIDI_NOTE] && notePlayed > 0) {
-							notePlayed++;
-						}
-					}
-					break;
-				case MIDI_NOTEOFF:
-					searchNote = 0;
-					noteToFind = midiNote;
-					if (!latchMode) {
-						latchPlaying = false;
-					} else {
-						latchPlaying = true;
-					}
-					if (!latchPlaying) {
-						notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
-						activeNotes = notesPressed;
-					}
-					else {
-						while (searchNote < NUM_VOICES)
-						{
-							if (midiNotes[searchNote][MIDI_NOTE] == noteToFind) {
-								searchNote = NUM_VOICES;
-								notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
-							}
-							searchNote++;
+	uint8_t channel = event.data[0] & 0x0F;
+
+	switch(status) {
+		case MIDI_NOTEON:
+			if (activeNotes > NUM_VOICES - 1) {
+				reset();
+			} else {
+				if (notesPressed == 0) {
+					if (!latchPlaying) { //TODO check if there needs to be an exception when using sync
+						octavePattern.reset();
+						// quantized, a step that has just passed is not caught up on
+						if (firstNoteMode != FIRST_NOTE_QUANTIZE) {
+							clock.reset();
 						}
-					}
-					if (!latchMode) {
-						while (searchNote < NUM_VOICES)
-						{
-							if (midiNotes[searchNote][MIDI_NOTE] == noteToFind)
-							{
-								midiNotes[searchNote][MIDI_NOTE] = EMPTY_SLOT;
-								midiNotes[searchNote][MIDI_CHANNEL] = 0;
-								searchNote = NUM_VOICES;
-							}
-							searchNote++;
+						firstNote = true;
+						firstNoteDeadline = frameCount;
+						if (firstNoteMode == FIRST_NOTE_WINDOW) {
+							firstNoteDeadline += static_cast<uint64_t>(chordWindow * 0.001f * sampleRate);
 						}
-						if (arpMode != ARP_PLAYED)
-							utils.quicksort(midiNotes, 0, NUM_VOICES - 1);
 					}
-					if (activeNotes == 0 && !latchPlaying && !latchMode) {
-						reset();
-					}
-					break;
-				default:
-					midiThroughEvent.frame = events[i].frame;
-					midiThroughEvent.size = events[i].size;
-					for (unsigned d = 0; d < midiThroughEvent.size; d++) {
-						midiThroughEvent.data[d] = events[i].data[d];
+					if (latchMode) {
+						latchPlaying = true;
+						activeNotes = 0;
+						keyboard.clear();
+						updateArpPattern();
 					}
-					midiHandler.appendMidiThroughMessage(midiThroughEvent);
-					break;
-			}
-		} else { //if arpeggiator is off
+					resetPattern = true;
+				}
 
-			if (!midiNotesCopied) {
-				for (unsigned b = 0; b < NUM_VOICES; b++) {
-					midiNotesBypassed[b] = midiNotes[b][MIDI_NOTE];
+				if (keyboard.noteOn(midiNote, channel)) {
+					notesPressed++;
+					activeNotes++;
+					insertNote(midiNote);
 				}
-				midiNotesCopied = true;
 			}
-
+			break;
+		case MIDI_NOTEOFF:
 			if (!latchMode) {
-
+				latchPlaying = false;
+			} else {
+				latchPlaying = true;
+			}
+			if (!latchPlaying) {
+				notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
+				activeNotes = notesPressed;
+			}
+			else if (keyboard.isHeld(midiNote)) {
+				notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
+			}
+			if (!latchMode) {
+				removeNote(midiNote);
+				keyboard.noteOff(midiNote);
+			}
+			if (activeNotes == 0 && !latchPlaying && !latchMode) {
 				reset();
+			}
+			break;
+		default:
+			midiHandler.appendMidiMessage(event);
+			break;
+	}
+}
 
-				for (unsigned clear_notes = 0; clear_notes < NUM_VOICES; clear_notes++) {
-					midiNotes[clear_notes][MIDI_NOTE] = EMPTY_SLOT;
-					midiNotes[clear_notes][MIDI_CHANNEL] = 0;
-				}
+// The arpeggiator is off, the input goes straight through. Notes still
+// sounding are ended right away and the clock is moved over the whole block
+// at once, so it keeps its phase for when the arpeggiator comes back on.
+void Arpeggiator::bypass(const MidiEvent* events, uint32_t eventCount, uint32_t n_frames)
+{
+	NoteOff noteOff;
+	while (!noteOffQueue.isEmpty()) {
+		noteOffQueue.popNext(noteOff);
+		sendNoteOff(noteOff, 0);
+	}
 
-			} else {
+	if (eventCount > 0) {
+		if (!latchMode) {
+			reset();
+		} else if (!midiNotesCopied) {
+			const int numNotes = keyboard.getSortedNotes(midiNotesBypassed, NUM_VOICES);
+			for (unsigned b = numNotes; b < NUM_VOICES; b++) {
+				midiNotesBypassed[b] = EMPTY_SLOT;
+			}
+			midiNotesCopied = true;
+		}
+		first = true;
+	}
 
-				uint8_t noteToFind = midiNote;
-				size_t searchNote = 0;
-
-				switch (status)
-				{
-					case MIDI_NOTEOFF:
-						while (searchNote < NUM_VOICES)
-						{
-							if (midiNotesBypassed[searchNote] == noteToFind) {
-								midiNotesBypassed[searchNote] = EMPTY_SLOT;
-								searchNote = NUM_VOICES;
-								notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
-							}
-							searchNote++;
-						}
-						break;
+	for (uint32_t i = 0; i < eventCount; ++i) {
+		const MidiEvent& event = events[i];
+
+		if (isReplacedByClockOutput(event)) {
+			continue;
+		}
+
+		// a latched note that is let go no longer counts as pressed
+		if (latchMode && (event.data[0] & 0xF0) == MIDI_NOTEOFF) {
+			for (size_t b = 0; b < NUM_VOICES; b++) {
+				if (midiNotesBypassed[b] == event.data[1]) {
+					midiNotesBypassed[b] = EMPTY_SLOT;
+					notesPressed = (notesPressed > 0) ? notesPressed - 1 : 0;
+					break;
 				}
 			}
+		}
+
+		midiHandler.appendMidiMessage(event);
+	}
+
+	if (clock.getSyncMode() <= 1 && first) {
+		clock.setPos(0);
+		clock.reset();
+#ifdef CLOCK_INSTRUMENTATION
+		clock.logHeldFrames(n_frames);
+#endif
+	} else {
+		clock.skip(n_frames);
+	}
+
+	frameCount += n_frames;
+}
 
-			//send MIDI message through
-			midiHandler.appendMidiThroughMessage(events[i]);
-			first = true;
+void Arpeggiator::process(const MidiEvent* events, uint32_t eventCount, uint32_t n_frames)
+{
+	struct MidiEvent midiEvent;
+
+	midiHandler.nextBlock();
+
+	if (!latchMode && previousLatch && notesPressed <= 0) {
+		reset();
+	}
+	if (latchMode != previousLatch) {
+		previousLatch = latchMode;
+	}
+
+	if (panic) {
+		reset();
+		panic = false;
+	}
+
+	// clock and transport messages go to the clock before it is updated,
+	// an external clock is followed a block at a time
+	for (uint32_t i = 0; i < eventCount; ++i) {
+		if ((events[i].data[0] & 0xF0) == MIDI_SYSTEM_EXCLUSIVE) {
+			clock.receiveMidiClock(events[i]);
 		}
 	}
 
-	arpPattern[arpMode]->setPatternSize(activeNotes);
+	clock.update(n_frames);
 
-	int patternSize;
+	// when the host loops or jumps the pattern can start over with the next step
+	if ((clock.getSyncMode() == HOST_BPM_SYNC || clock.getSyncMode() == HOST_QUANTIZED_SYNC) && clock.wasRelocated()) {
+		if (restartMode == RESTART_ON_JUMP || (restartMode == RESTART_ON_LOOP && clock.getJumpBeats() < 0.0)) {
+			resetPattern = true;
+		}
+	}
 
-	switch (arpMode)
-	{
-		case ARP_UP_DOWN:
-			patternSize = (activeNotes >= 3) ? activeNotes + (activeNotes - 2) : activeNotes;
-			break;
-		case ARP_UP_DOWN_ALT:
-			patternSize = (activeNotes >= 3) ? activeNotes * 2 : activeNotes;
-			break;
-		default:
-			patternSize = activeNotes;
-			break;
+	// free running and host bpm sync start the clock over with the first
+	// note, the clock output stops until then
+	if (clock.getSyncMode() <= 1) {
+		if (first) {
+			clockSender.hold(n_frames);
+		} else {
+			clockSender.schedule(clock, true, n_frames);
+		}
+	} else {
+		clockSender.schedule(clock, clock.isPlaying(), n_frames);
 	}
 
-	switch (octaveMode)
-	{
-		case ONE_OCT_UP_PER_CYCLE:
-			octavePattern[octaveMode]->setPatternSize(patternSize);
-			octavePattern[octaveMode]->setCycleRange(octaveSpread);
-			break;
-		default:
-			octavePattern[octaveMode]->setPatternSize(octaveSpread);
-			break;
+	if (!arpEnabled) {
+		bypass(events, eventCount, n_frames);
+		midiHandler.flush();
+		return;
 	}
 
-	for (unsigned s = 0; s < n_frames; s++) {
+	uint32_t nextEvent = 0;
+
+	for (uint32_t s = 0; s < n_frames; s++) {
 
-		bool timeOut = (firstNoteTimer > (int)timeOutTime) ? false : true;
+		// input comes in between the clock edges, on the frame it was played
+		while (nextEvent < eventCount && events[nextEvent].frame <= s) {
+			processEvent(events[nextEvent++]);
+		}
 
+		// note-offs first, a note ending on this frame must not cut the next one
+		NoteOff noteOff;
+		while (noteOffQueue.popDue(frameCount, noteOff)) {
+			sendNoteOff(noteOff, s);
+		}
+
+		// the first note only starts on a frame a gate opens on, one that
+		// opened while it waited for its deadline is let go
 		if (firstNote) {
-			clock.closeGate(); //close gate to prevent opening before timeOut
-			firstNoteTimer++;
+			clock.closeGate();
 		}
 
 		if (clock.getSyncMode() <= 1 && first) {
@@ -490,27 +695,24 @@ void Arpeggiator::process(const MidiEvent* events, uint32_t eventCount, uint32_t
 
 		clock.tick();
 
-		if ((clock.getGate() && !timeOut)) {
+		// started right away the first note does not wait for the grid
+		const bool firstNoteDue = frameCount >= firstNoteDeadline;
+		const bool firstNoteNow = firstNote && firstNoteDue && firstNoteMode == FIRST_NOTE_IMMEDIATE;
+
+		if ((clock.getGate() || firstNoteNow) && firstNoteDue) {
 
 			if (arpEnabled) {
 
 				if (resetPattern) {
-					octavePattern[octaveMode]->reset();
-					if (octaveMode == ARP_DOWN) {
-						octavePattern[octaveMode]->setStep(activeNotes - 1); //TODO maybe put this in reset()
-					}
-
-					arpPattern[arpMode]->reset();
-					if (arpMode == ARP_DOWN) {
-						arpPattern[arpMode]->setStep(activeNotes - 1);
-					}
-
+					resetPatterns();
 					resetPattern = false;
-					notePlayed = arpPattern[arpMode]->getStep();
 				}
 
 				if (first) {
 
+					if (clock.getSyncMode() <= 1) {
+						clockSender.start(clock, s);
+					}
 					for (uint8_t c = 0; c < NUM_MIDI_CHANNELS; c++) {
 						//send note off for everything
 						midiEvent.frame = s;
@@ -525,68 +727,52 @@ void Arpeggiator::process(const MidiEvent* events, uint32_t eventCount, uint32_t
 				}
 			}
 
-			size_t searchedVoices = 0;
-			bool   noteFound = false;
-
-			while (!noteFound && searchedVoices < NUM_VOICES)
-			{
-				notePlayed = (notePlayed < 0) ? 0 : notePlayed;
-
-				if (midiNotes[notePlayed][MIDI_NOTE] > 0
-						&& midiNotes[notePlayed][MIDI_NOTE] < 128)
-				{
-					//create MIDI note on message
-					uint8_t midiNote = midiNotes[notePlayed][MIDI_NOTE];
-					uint8_t channel = midiNotes[notePlayed][MIDI_CHANNEL];
-
-					if (arpEnabled) {
-
-						uint8_t octave = octavePattern[octaveMode]->getStep() * 12;
-						octavePattern[octaveMode]->goToNextStep();
-
-						midiNote = midiNote + octave;
-
-						midiEvent.frame = s;
-						midiEvent.size = 3;
-						midiEvent.data[0] = MIDI_NOTEON | channel;
-						midiEvent.data[1] = midiNote;
-						midiEvent.data[2] = velocity;
+			if (arpEnabled && !arpPattern.isEmpty()) {
+				//create MIDI note on message
+				const uint8_t arpNote = arpPattern.getNextValue();
+				const uint8_t channel = keyboard.getChannel(arpNote);
 
-						midiHandler.appendMidiMessage(midiEvent);
+				int midiNote = arpNote + octavePattern.getNextValue();
+				while (midiNote > 127) {
+					midiNote -= 12;
+				}
 
-						noteOffBuffer[activeNotesIndex][MIDI_NOTE] = (uint32_t)midiNote;
-						noteOffBuffer[activeNotesIndex][MIDI_CHANNEL] = (uint32_t)channel;
-						activeNotesIndex = (activeNotesIndex + 1) % NUM_NOTE_OFF_SLOTS;
-						noteFound = true;
-						firstNote = false;
+				// a note still sounding from an earlier step is tied over instead of retriggered
+				if (!noteOffQueue.isPending(midiNote, channel)) {
+					if (noteOffQueue.isFull()) {
+						noteOffQueue.popNext(noteOff);
+						sendNoteOff(noteOff, s);
 					}
-				}
-				arpPattern[arpMode]->goToNextStep();
-				notePlayed = arpPattern[arpMode]->getStep();
-				searchedVoices++;
-			}
-			clock.closeGate();
-		}
 
-		for (size_t i = 0; i < NUM_NOTE_OFF_SLOTS; i++) {
-			if (noteOffBuffer[i][MIDI_NOTE] != EMPTY_SLOT) {
-				noteOffBuffer[i][TIMER] += 1;
-				if (noteOffBuffer[i][TIMER] > static_cast<uint32_t>(clock.getPeriod() * noteLength)) {
 					midiEvent.frame = s;
 					midiEvent.size = 3;
-					midiEvent.data[0] = MIDI_NOTEOFF | noteOffBuffer[i][MIDI_CHANNEL];
-					midiEvent.data[1] = static_cast<uint8_t>(noteOffBuffer[i][MIDI_NOTE]);
-					midiEvent.data[2] = 0;
+					midiEvent.data[0] = MIDI_NOTEON | channel;
+					midiEvent.data[1] = midiNote;
+					midiEvent.data[2] = velocity;
 
 					midiHandler.appendMidiMessage(midiEvent);
-
-					noteOffBuffer[i][MIDI_NOTE] = EMPTY_SLOT;
-					noteOffBuffer[i][MIDI_CHANNEL] = 0;
-					noteOffBuffer[i][TIMER] = 0;
-
 				}
+
+				const uint32_t noteLengthFrames = static_cast<uint32_t>(clock.getPeriod() * noteLength * clock.getGateScale());
+				noteOffQueue.schedule(midiNote, channel, frameCount + std::max<uint32_t>(noteLengthFrames, 1));
+				firstNote = false;
 			}
+			clock.closeGate();
+		}
+
+		uint32_t idleFrames = getIdleFrames(n_frames - s - 1);
+		if (nextEvent < eventCount) {
+			idleFrames = std::min(idleFrames, events[nextEvent].frame - s - 1);
 		}
+		skipFrames(idleFrames);
+		s += idleFrames;
+		frameCount++;
 	}
-	midiHandler.mergeBuffers();
+
+	// events the host put past the end of the block
+	while (nextEvent < eventCount) {
+		processEvent(events[nextEvent++]);
+	}
+
+	midiHandler.flush();
 }
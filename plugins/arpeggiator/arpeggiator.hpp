@@ -6,25 +6,25 @@
 #include "../../common/clock.hpp"
 #include "../../common/pattern.hpp"
 #include "../../common/midiHandler.hpp"
-#include "utils.hpp"
+#include "../../common/midiClockSender.hpp"
+#include "../../common/keyboardState.hpp"
+#include "../../common/noteOffQueue.hpp"
 
 #define NUM_VOICES 32
-#define NUM_NOTE_OFF_SLOTS 32
 #define PLUGIN_URI "http://moddevices.com/plugins/mod-devel/arpeggiator"
 
 #define MIDI_NOTEOFF 0x80
 #define MIDI_NOTEON  0x90
 
-#define MIDI_NOTE 0
-#define MIDI_CHANNEL 1
-#define TIMER 2
-
 #define NUM_ARP_MODES 6
 #define NUM_OCTAVE_MODES 5
+#define NUM_RESTART_MODES 3
+#define NUM_FIRST_NOTE_MODES 3
 
 #define NUM_MIDI_CHANNELS 16
 
 #define ONE_OCT_UP_PER_CYCLE 4
+#define MAX_OCTAVE_SPREAD 10
 
 class Arpeggiator {
 public:
@@ -36,6 +36,16 @@ public:
 		ARP_PLAYED,
 		ARP_RANDOM
 	};
+	enum RestartModes {
+		RESTART_NEVER = 0,
+		RESTART_ON_LOOP,
+		RESTART_ON_JUMP
+	};
+	enum FirstNoteModes {
+		FIRST_NOTE_WINDOW = 0,
+		FIRST_NOTE_IMMEDIATE,
+		FIRST_NOTE_QUANTIZE
+	};
 	Arpeggiator();
 	~Arpeggiator();
 	void setArpEnabled(bool arpEnabled);
@@ -50,6 +60,14 @@ public:
 	void setArpMode(int arpMode);
 	void setOctaveMode(int octaveMode);
 	void setPanic(bool panic);
+	void setSeed(int seed);
+	void setClockOutput(bool clockOutput);
+	void setSwing(float swing);
+	void setGroove(int groove);
+	void setGrooveTemplate(const GrooveTemplate& groove);
+	void setRestartMode(int restartMode);
+	void setFirstNoteMode(int firstNoteMode);
+	void setChordWindow(float chordWindow);
 	bool getArpEnabled() const;
 	bool getLatchMode() const;
 	float getSampleRate() const;
@@ -62,25 +80,53 @@ public:
 	int getArpMode() const;
 	int getOctaveMode() const;
 	bool getPanic() const;
-	void transmitHostInfo(const bool playing, const float beatsPerBar,
-	const int beat, const float barBeat, const double bpm);
+	int getSeed() const;
+	bool getClockOutput() const;
+	float getSwing() const;
+	int getGroove() const;
+	int getRestartMode() const;
+	int getFirstNoteMode() const;
+	float getChordWindow() const;
+	uint32_t getDroppedEvents() const;
+	uint32_t getDroppedNoteOffs() const;
+	void resetDroppedEvents();
+	void transmitHostInfo(const TimePosition& position);
 	void reset();
-	void emptyMidiBuffer();
-	struct MidiBuffer getMidiBuffer();
+	void setEventSink(MidiEventSink* sink);
 	void process(const MidiEvent* event, uint32_t eventCount, uint32_t n_frames);
+#ifdef CLOCK_INSTRUMENTATION
+	void setGateLog(GateLog* gateLog);
+#endif
 private:
+	uint32_t getInstanceSeed();
+	void resetPatterns();
+	void updateArpPattern();
+	void updateOctavePattern();
+	void insertNote(uint8_t note);
+	void removeNote(uint8_t note);
+	uint32_t getIdleFrames(uint32_t maxFrames) const;
+	void skipFrames(uint32_t frames);
+	void sendNoteOff(const NoteOff& noteOff, uint32_t frame);
+	bool isReplacedByClockOutput(const MidiEvent& event) const;
+	void processEvent(const MidiEvent& event);
+	void bypass(const MidiEvent* events, uint32_t eventCount, uint32_t n_frames);
 
 	int notesPressed = 0;
 	int activeNotes = 0;
-	int notePlayed = 0;
 
-	uint8_t midiNotes[NUM_VOICES][2];
 	uint8_t midiNotesBypassed[NUM_VOICES];
-	uint32_t noteOffBuffer[NUM_NOTE_OFF_SLOTS][3];
 
 	int octaveMode = 0;
 	int octaveSpread = 1;
 	int arpMode = 0;
+	int seed = 0;
+	uint32_t instanceSeed = 0;
+	uint32_t numInstanceSeeds = 0;
+	int groove = 0;
+	int restartMode = RESTART_NEVER;
+	int firstNoteMode = FIRST_NOTE_WINDOW;
+	float chordWindow = 20.f;
+	float swing = 50.f;
 
 	float noteLength = 0.8;
 
@@ -88,11 +134,12 @@ private:
 	uint8_t previousMidiNote = 0;
 	uint8_t velocity = 80;
 	int previousSyncMode = 0;
-	int activeNotesIndex = 0;
 	int activeNotesBypassed = 0;
-	int timeOutTime = 1000;
-	int firstNoteTimer = 0;
-	float barBeat;
+	uint64_t frameCount = 0;
+
+	// no gate plays before this frame, from a reset until the first note
+	// of a phrase set it
+	uint64_t firstNoteDeadline = UINT64_MAX;
 
 	bool pluginEnabled = true;
 	bool first = false;
@@ -111,11 +158,13 @@ private:
 	float sampleRate = 48000;
 	double bpm = 0;
 
-	ArpUtils utils;
-	Pattern **arpPattern;
-	Pattern **octavePattern;
+	KeyboardState keyboard;
+	NoteOffQueue noteOffQueue;
+	Pattern arpPattern;
+	Pattern octavePattern;
 	MidiHandler midiHandler;
 	PluginClock clock;
+	MidiClockSender clockSender;
 };
 
 #endif //_H_ARPEGGIATOR_
@@ -1,5 +1,7 @@
 #include "plugin.hpp"
 
+#include <algorithm>
+
 START_NAMESPACE_DISTRHO
 
 // -----------------------------------------------------------------------
@@ -7,9 +9,9 @@ START_NAMESPACE_DISTRHO
 PluginArpeggiator::PluginArpeggiator()
 	: Plugin(paramCount, 0, 0)  // paramCount params, 12 program(s), 0 states
 {
-	arpeggiator.transmitHostInfo(0, 4, 1, 1, 120.0);
 	arpeggiator.setSampleRate(static_cast<float>(getSampleRate()));
 	arpeggiator.setDivision(7);
+	arpeggiator.setEventSink(this);
 }
 
 // -----------------------------------------------------------------------
@@ -26,8 +28,8 @@ void PluginArpeggiator::initParameter(uint32_t index, Parameter& parameter)
 			parameter.symbol = "sync";
 			parameter.ranges.def = 0;
 			parameter.ranges.min = 0;
-			parameter.ranges.max = 2;
-			parameter.enumValues.count = 3;
+			parameter.ranges.max = 3;
+			parameter.enumValues.count = 4;
 			parameter.enumValues.restrictedMode = true;
 			{
 				ParameterEnumerationValue* const channels = new ParameterEnumerationValue[13];
@@ -38,6 +40,8 @@ void PluginArpeggiator::initParameter(uint32_t index, Parameter& parameter)
 				channels[1].value = 1;
 				channels[2].label = "Host Sync (Quantized Start)";
 				channels[2].value = 2;
+				channels[3].label = "MIDI Clock";
+				channels[3].value = 3;
 			}
 			break;
 		case paramBpm:
@@ -54,38 +58,16 @@ void PluginArpeggiator::initParameter(uint32_t index, Parameter& parameter)
 			parameter.symbol = "Divisons";
 			parameter.ranges.def = 9;
 			parameter.ranges.min = 0;
-			parameter.ranges.max = 12;
-			parameter.enumValues.count = 13;
+			parameter.ranges.max = NUM_DIVISIONS - 1;
+			parameter.enumValues.count = NUM_DIVISIONS;
 			parameter.enumValues.restrictedMode = true;
 			{
-				ParameterEnumerationValue* const channels = new ParameterEnumerationValue[13];
+				ParameterEnumerationValue* const channels = new ParameterEnumerationValue[NUM_DIVISIONS];
 				parameter.enumValues.values = channels;
-				channels[0].label = "1/1";
-				channels[0].value = 0;
-				channels[1].label = "1/2";
-				channels[1].value = 1;
-				channels[2].label = "1/3";
-				channels[2].value = 2;
-				channels[3].label = "1/4";
-				channels[3].value = 3;
-				channels[4].label = "1/4.";
-				channels[4].value = 4;
-				channels[5].label = "1/4T";
-				channels[5].value = 5;
-				channels[6].label = "1/8";
-				channels[6].value = 6;
-				channels[7].label = "1/8.";
-				channels[7].value = 7;
-				channels[8].label = "1/8T";
-				channels[8].value = 8;
-				channels[9].label = "1/16";
-				channels[9].value = 9;
-				channels[10].label = "1/16.";
-				channels[10].value = 10;
-				channels[11].label = "1/16T";
-				channels[11].value = 11;
-				channels[12].label = "1/32";
-				channels[12].value = 12;
+				for (int i = 0; i < NUM_DIVISIONS; i++) {
+					channels[i].label = divisions[i].label;
+					channels[i].value = i;
+				}
 			}
 			break;
 		case paramVelocity:
@@ -103,7 +85,7 @@ void PluginArpeggiator::initParameter(uint32_t index, Parameter& parameter)
 			parameter.unit       = "";
 			parameter.ranges.def = 0.f;
 			parameter.ranges.min = 0.f;
-			parameter.ranges.max = 1.f;
+			parameter.ranges.max = 2.f;
 			break;
 		case paramOctaveSpread:
 			parameter.hints = kParameterIsAutomable | kParameterIsInteger;
@@ -204,6 +186,117 @@ void PluginArpeggiator::initParameter(uint32_t index, Parameter& parameter)
 			parameter.ranges.min = 0.f;
 			parameter.ranges.max = 1.f;
 			break;
+		case paramSeed:
+			parameter.hints = kParameterIsAutomable | kParameterIsInteger;
+			parameter.name = "Random Seed";
+			parameter.symbol = "seed";
+			parameter.ranges.def = 0;
+			parameter.ranges.min = 0;
+			parameter.ranges.max = 65535;
+			break;
+		case paramClockOutput:
+			parameter.hints      = kParameterIsAutomable | kParameterIsBoolean;
+			parameter.name       = "Clock Output";
+			parameter.symbol     = "clockOutput";
+			parameter.unit       = "";
+			parameter.ranges.def = 0.f;
+			parameter.ranges.min = 0.f;
+			parameter.ranges.max = 1.f;
+			break;
+		case paramSwing:
+			parameter.hints      = kParameterIsAutomable;
+			parameter.name       = "Swing";
+			parameter.symbol     = "swing";
+			parameter.unit       = "%";
+			parameter.ranges.def = 50.f;
+			parameter.ranges.min = 50.f;
+			parameter.ranges.max = 75.f;
+			break;
+		case paramGroove:
+			parameter.hints = kParameterIsAutomable | kParameterIsInteger;
+			parameter.name = "Groove";
+			parameter.symbol = "groove";
+			parameter.ranges.def = 0;
+			parameter.ranges.min = 0;
+			parameter.ranges.max = NUM_GROOVE_TEMPLATES - 1;
+			parameter.enumValues.count = NUM_GROOVE_TEMPLATES;
+			parameter.enumValues.restrictedMode = true;
+			{
+				ParameterEnumerationValue* const grooves = new ParameterEnumerationValue[NUM_GROOVE_TEMPLATES];
+				parameter.enumValues.values = grooves;
+				for (int g = 0; g < NUM_GROOVE_TEMPLATES; g++) {
+					grooves[g].label = grooveTemplates[g].name;
+					grooves[g].value = g;
+				}
+			}
+			break;
+		case paramRestart:
+			parameter.hints = kParameterIsAutomable | kParameterIsInteger;
+			parameter.name = "Restart";
+			parameter.symbol = "restart";
+			parameter.ranges.def = 0;
+			parameter.ranges.min = 0;
+			parameter.ranges.max = 2;
+			parameter.enumValues.count = 3;
+			parameter.enumValues.restrictedMode = true;
+			{
+				ParameterEnumerationValue* const channels = new ParameterEnumerationValue[3];
+				parameter.enumValues.values = channels;
+				channels[0].label = "Never";
+				channels[0].value = 0;
+				channels[1].label = "On Loop";
+				channels[1].value = 1;
+				channels[2].label = "On Any Jump";
+				channels[2].value = 2;
+			}
+			break;
+		case paramFirstNote:
+			parameter.hints = kParameterIsAutomable | kParameterIsInteger;
+			parameter.name = "First Note";
+			parameter.symbol = "firstNote";
+			parameter.ranges.def = 0;
+			parameter.ranges.min = 0;
+			parameter.ranges.max = 2;
+			parameter.enumValues.count = 3;
+			parameter.enumValues.restrictedMode = true;
+			{
+				ParameterEnumerationValue* const channels = new ParameterEnumerationValue[3];
+				parameter.enumValues.values = channels;
+				channels[0].label = "Chord Window";
+				channels[0].value = 0;
+				channels[1].label = "Immediate";
+				channels[1].value = 1;
+				channels[2].label = "Quantize";
+				channels[2].value = 2;
+			}
+			break;
+		case paramChordWindow:
+			parameter.hints      = kParameterIsAutomable;
+			parameter.name       = "Chord Window";
+			parameter.symbol     = "chordWindow";
+			parameter.unit       = "ms";
+			parameter.ranges.def = 20.f;
+			parameter.ranges.min = 0.f;
+			parameter.ranges.max = 100.f;
+			break;
+		case paramDroppedEvents:
+			parameter.hints      = kParameterIsOutput | kParameterIsInteger;
+			parameter.name       = "Dropped Events";
+			parameter.symbol     = "dropped";
+			parameter.unit       = "";
+			parameter.ranges.def = 0.f;
+			parameter.ranges.min = 0.f;
+			parameter.ranges.max = 1000000.f;
+			break;
+		case paramDroppedNoteOffs:
+			parameter.hints      = kParameterIsOutput | kParameterIsInteger;
+			parameter.name       = "Dropped Note-Offs";
+			parameter.symbol     = "droppedNoteOffs";
+			parameter.unit       = "";
+			parameter.ranges.def = 0.f;
+			parameter.ranges.min = 0.f;
+			parameter.ranges.max = 1000000.f;
+			break;
 	}
 }
 
@@ -249,6 +342,24 @@ float PluginArpeggiator::getParameterValue(uint32_t index) const
 			return arpeggiator.getPanic();
 		case paramEnabled:
 			return arpeggiator.getArpEnabled();
+		case paramSeed:
+			return arpeggiator.getSeed();
+		case paramClockOutput:
+			return arpeggiator.getClockOutput();
+		case paramSwing:
+			return arpeggiator.getSwing();
+		case paramGroove:
+			return arpeggiator.getGroove();
+		case paramRestart:
+			return arpeggiator.getRestartMode();
+		case paramFirstNote:
+			return arpeggiator.getFirstNoteMode();
+		case paramChordWindow:
+			return arpeggiator.getChordWindow();
+		case paramDroppedEvents:
+			return std::min<float>(arpeggiator.getDroppedEvents(), 1000000.f);
+		case paramDroppedNoteOffs:
+			return std::min<float>(arpeggiator.getDroppedNoteOffs(), 1000000.f);
 	}
 }
 
@@ -292,6 +403,27 @@ void PluginArpeggiator::setParameterValue(uint32_t index, float value)
 		case paramEnabled:
 			arpeggiator.setArpEnabled(static_cast<bool>(value));
 			break;
+		case paramSeed:
+			arpeggiator.setSeed(static_cast<int>(value));
+			break;
+		case paramClockOutput:
+			arpeggiator.setClockOutput(static_cast<bool>(value));
+			break;
+		case paramSwing:
+			arpeggiator.setSwing(value);
+			break;
+		case paramGroove:
+			arpeggiator.setGroove(static_cast<int>(value));
+			break;
+		case paramRestart:
+			arpeggiator.setRestartMode(static_cast<int>(value));
+			break;
+		case paramFirstNote:
+			arpeggiator.setFirstNoteMode(static_cast<int>(value));
+			break;
+		case paramChordWindow:
+			arpeggiator.setChordWindow(value);
+			break;
 	}
 }
 
@@ -300,25 +432,23 @@ void PluginArpeggiator::setParameterValue(uint32_t index, float value)
 
 void PluginArpeggiator::activate()
 {
-	// plugin is activated
+	// plugin is activated, events dropped before do not count
+	arpeggiator.resetDroppedEvents();
 }
 
 void PluginArpeggiator::run(const float**, float**, uint32_t n_frames,
 		const MidiEvent* events, uint32_t eventCount)
 {
-	arpeggiator.emptyMidiBuffer();
-
-	// Check if host supports Bar-Beat-Tick position
+	// without a Bar-Beat-Tick position the host counts as stopped
 	const TimePosition& position = getTimePosition();
-	if (!position.bbt.valid) return;
-	arpeggiator.transmitHostInfo(position.playing, position.bbt.beatsPerBar, position.bbt.beat, position.bbt.barBeat, static_cast<float>(position.bbt.beatsPerMinute));
+	arpeggiator.transmitHostInfo(position);
 
 	arpeggiator.process(events, eventCount, n_frames);
+}
 
-	struct MidiBuffer buffer = arpeggiator.getMidiBuffer();
-	for (unsigned x = 0; x < buffer.numBufferedEvents + buffer.numBufferedThroughEvents; x++) {
-		writeMidiEvent(buffer.bufferedEvents[x]); //needs to be one struct or array?
-	}
+bool PluginArpeggiator::writeEvent(const MidiEvent& event)
+{
+	return writeMidiEvent(event);
 }
 
 // -----------------------------------------------------------------------
@@ -10,7 +10,7 @@ START_NAMESPACE_DISTRHO
 
 // -----------------------------------------------------------------------
 
-class PluginArpeggiator : public Plugin {
+class PluginArpeggiator : public Plugin, public MidiEventSink {
 public:
 	enum Parameters {
 		paramSyncMode = 0,
@@ -24,6 +24,15 @@ public:
 		paramLatch,
 		paramPanic,
 		paramEnabled,
+		paramSeed,
+		paramClockOutput,
+		paramSwing,
+		paramGroove,
+		paramRestart,
+		paramFirstNote,
+		paramChordWindow,
+		paramDroppedEvents,
+		paramDroppedNoteOffs,
 		paramCount
 	};
 
@@ -86,6 +95,9 @@ protected:
     void run(const float**, float**, uint32_t,
              const MidiEvent* midiEvents, uint32_t midiEventCount) override;
 
+    // the arpeggiator writes its output straight to the host
+    bool writeEvent(const MidiEvent& event) override;
+
 
     // -------------------------------------------------------------------
 
@@ -0,0 +1,964 @@
+#include "arpeggiator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BENCH_SAMPLE_RATE 48000.f
+#define BENCH_BPM 120.0
+#define BENCH_TICKS_PER_BEAT 1920.0
+#define BENCH_DEFAULT_SECONDS 4.0
+#define BENCH_WARMUP_SECONDS 0.5
+#define BENCH_OCTAVE_SPREAD 3
+#define BENCH_STORM_BLOCKS 64
+#define BENCH_STORM_MAX_EVENTS 256
+#define BENCH_PATTERN_STEPS 20000000
+#define BENCH_PATTERN_SETUPS 200000
+#define BENCH_ISOLATED_OPS 10000000
+
+typedef std::chrono::steady_clock BenchClock;
+
+static volatile uint32_t benchSink = 0;
+
+static double elapsedNs(const BenchClock::time_point& start)
+{
+	return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+// one measurement: a group, the configuration it ran with and what came out
+struct BenchResult {
+	std::string group;
+	std::vector<std::pair<std::string, std::string> > config;
+	std::vector<std::pair<std::string, double> > metrics;
+
+	BenchResult(const char* group) : group(group), config(), metrics() {}
+
+	void addConfig(const char* key, const char* value)
+	{
+		config.push_back(std::make_pair(std::string(key), std::string("\"") + value + "\""));
+	}
+	void addConfig(const char* key, long value)
+	{
+		config.push_back(std::make_pair(std::string(key), std::to_string(value)));
+	}
+	void addMetric(const char* key, double value)
+	{
+		metrics.push_back(std::make_pair(std::string(key), value));
+	}
+};
+
+struct BenchOptions {
+	double seconds;
+	bool json;
+	const char* filter;
+};
+
+static std::vector<BenchResult> benchResults;
+static BenchOptions benchOptions = {BENCH_DEFAULT_SECONDS, false, nullptr};
+
+static bool isSelected(const char* group)
+{
+	return benchOptions.filter == nullptr || strstr(group, benchOptions.filter) != nullptr;
+}
+
+static void printResult(const BenchResult& result)
+{
+	if (benchOptions.json) {
+		return;
+	}
+
+	std::string line = result.group;
+	for (size_t c = 0; c < result.config.size(); c++) {
+		std::string value = result.config[c].second;
+		value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+		line += " " + result.config[c].first + "=" + value;
+	}
+
+	printf("%-64s", line.c_str());
+	for (size_t m = 0; m < result.metrics.size(); m++) {
+		printf(" %s=%.2f", result.metrics[m].first.c_str(), result.metrics[m].second);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void addResult(const BenchResult& result)
+{
+	benchResults.push_back(result);
+	printResult(result);
+}
+
+static void printJson()
+{
+	printf("{\n");
+	printf("  \"compiler\": \"%s\",\n", __VERSION__);
+	printf("  \"sample_rate\": %.0f,\n", BENCH_SAMPLE_RATE);
+	printf("  \"seconds\": %.3f,\n", benchOptions.seconds);
+	printf("  \"results\": [\n");
+
+	for (size_t r = 0; r < benchResults.size(); r++) {
+		const BenchResult& result = benchResults[r];
+
+		printf("    {\"group\": \"%s\", \"config\": {", result.group.c_str());
+		for (size_t c = 0; c < result.config.size(); c++) {
+			printf("%s\"%s\": %s", (c > 0) ? ", " : "", result.config[c].first.c_str(), result.config[c].second.c_str());
+		}
+		printf("}, \"metrics\": {");
+		for (size_t m = 0; m < result.metrics.size(); m++) {
+			printf("%s\"%s\": %.3f", (m > 0) ? ", " : "", result.metrics[m].first.c_str(), result.metrics[m].second);
+		}
+		printf("}}%s\n", (r + 1 < benchResults.size()) ? "," : "");
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+}
+
+// what reading the clock twice costs, every per-block time includes it once
+static double measureTimerOverhead()
+{
+	double total = 0.0;
+
+	for (unsigned n = 0; n < 100000; n++) {
+		const BenchClock::time_point start = BenchClock::now();
+		total += elapsedNs(start);
+	}
+
+	return total / 100000;
+}
+
+// ---------------------------------------------------------------------------
+// process()
+
+static const char* arpModeNames[NUM_ARP_MODES] = {"up", "down", "updown", "updown_alt", "played", "random"};
+static const char* octaveModeNames[NUM_OCTAVE_MODES] = {"up", "down", "updown", "updown_alt", "cycle"};
+static const char* syncModeNames[] = {"free", "host_bpm", "host_quantized", "midi_clock"};
+
+struct ProcessConfig {
+	uint32_t blockSize;
+	int numNotes;
+	int arpMode;
+	int octaveMode;
+	int syncMode;
+	bool storm;
+};
+
+static void setNoteEvent(MidiEvent& event, uint32_t frame, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	event.frame = frame;
+	event.size = 3;
+	event.data[0] = status;
+	event.data[1] = data1;
+	event.data[2] = data2;
+	event.data[3] = 0;
+	event.dataExt = nullptr;
+}
+
+static void setClockEvent(MidiEvent& event, uint32_t frame, uint8_t status)
+{
+	event.frame = frame;
+	event.size = 1;
+	event.data[0] = status;
+	event.data[1] = 0;
+	event.data[2] = 0;
+	event.data[3] = 0;
+	event.dataExt = nullptr;
+}
+
+// adds up what the engine writes, so none of the output can be optimized away
+class SumSink : public MidiEventSink {
+public:
+	SumSink() : sum(0) {}
+
+	bool writeEvent(const MidiEvent& event) override
+	{
+		sum += event.data[1];
+		return true;
+	}
+
+	uint32_t sum;
+};
+
+// what a host playing at a steady tempo reports for the given frame
+static TimePosition getPosition(bool playing, uint64_t frame)
+{
+	const double beats = frame / (BENCH_SAMPLE_RATE * 60.0 / BENCH_BPM);
+	const long wholeBeats = static_cast<long>(beats);
+
+	TimePosition position;
+	position.playing = playing;
+	position.frame = frame;
+	position.bbt.valid = true;
+	position.bbt.bar = static_cast<int32_t>(wholeBeats / 4 + 1);
+	position.bbt.beat = static_cast<int32_t>(wholeBeats % 4 + 1);
+	position.bbt.barBeat = static_cast<float>(wholeBeats % 4 + (beats - wholeBeats));
+	position.bbt.tick = static_cast<int32_t>((beats - wholeBeats) * BENCH_TICKS_PER_BEAT);
+	position.bbt.beatsPerBar = 4;
+	position.bbt.beatType = 4;
+	position.bbt.ticksPerBeat = BENCH_TICKS_PER_BEAT;
+	position.bbt.beatsPerMinute = BENCH_BPM;
+
+	return position;
+}
+
+// the same spread out chord for every run, so results compare across commits
+static void holdNotes(Arpeggiator& arp, int numNotes, uint32_t blockSize)
+{
+	MidiEvent events[NUM_VOICES];
+
+	for (int n = 0; n < numNotes; n++) {
+		setNoteEvent(events[n], 0, MIDI_NOTEON, static_cast<uint8_t>(36 + (n * 7) % 60), 100);
+	}
+
+	arp.transmitHostInfo(getPosition(true, 0));
+	arp.process(events, numNotes, std::min<uint32_t>(blockSize, 4096));
+}
+
+// blocks of dense input, note on/off pairs mixed with controllers and pitch bend
+static void buildStorm(std::vector<MidiEvent>& events, std::vector<uint32_t>& counts, uint32_t blockSize)
+{
+	RandomGenerator random;
+	const uint32_t numEvents = std::min<uint32_t>(blockSize, BENCH_STORM_MAX_EVENTS);
+
+	random.setSeed(blockSize);
+	events.resize(BENCH_STORM_BLOCKS * numEvents);
+	counts.resize(BENCH_STORM_BLOCKS);
+
+	for (unsigned b = 0; b < BENCH_STORM_BLOCKS; b++) {
+		for (uint32_t e = 0; e < numEvents; e++) {
+			MidiEvent& event = events[b * numEvents + e];
+			const uint32_t frame = static_cast<uint32_t>(static_cast<uint64_t>(e) * blockSize / numEvents);
+			const uint8_t note = static_cast<uint8_t>(36 + random.getRange(48));
+
+			switch (random.getRange(4))
+			{
+				case 0:
+					setNoteEvent(event, frame, MIDI_NOTEON, note, 100);
+					break;
+				case 1:
+					setNoteEvent(event, frame, MIDI_NOTEOFF, note, 0);
+					break;
+				case 2:
+					setNoteEvent(event, frame, 0xB0, 1, static_cast<uint8_t>(random.getRange(128)));
+					break;
+				default:
+					setNoteEvent(event, frame, 0xE0, 0, static_cast<uint8_t>(random.getRange(128)));
+					break;
+			}
+		}
+		counts[b] = numEvents;
+	}
+}
+
+static void benchProcess(const char* group, const ProcessConfig& config, double timerOverhead)
+{
+	Arpeggiator* arp = new Arpeggiator();
+
+	arp->setSampleRate(BENCH_SAMPLE_RATE);
+	arp->setBpm(BENCH_BPM);
+	arp->setDivision(9);
+	arp->setSyncMode(config.syncMode);
+	arp->setArpMode(config.arpMode);
+	arp->setOctaveMode(config.octaveMode);
+	arp->setOctaveSpread(BENCH_OCTAVE_SPREAD);
+	arp->setArpEnabled(true);
+	holdNotes(*arp, config.numNotes, config.blockSize);
+
+	SumSink sink;
+	arp->setEventSink(&sink);
+
+	std::vector<MidiEvent> stormEvents;
+	std::vector<uint32_t> stormCounts;
+	if (config.storm) {
+		buildStorm(stormEvents, stormCounts, config.blockSize);
+	}
+	const uint32_t stormStride = std::min<uint32_t>(config.blockSize, BENCH_STORM_MAX_EVENTS);
+
+	// an external clock at the same tempo, started with the first block, so
+	// the follower locks during the warmup
+	const bool midiClock = config.syncMode == MIDI_CLOCK_SYNC;
+	const double clockPeriod = BENCH_SAMPLE_RATE * 60.0 / (BENCH_BPM * MIDI_CLOCK_PPQN);
+	double nextClockFrame = 0.0;
+	std::vector<MidiEvent> blockEvents;
+
+	const unsigned numWarmup = static_cast<unsigned>(BENCH_SAMPLE_RATE * BENCH_WARMUP_SECONDS / config.blockSize) + 1;
+	const unsigned numBlocks = static_cast<unsigned>(BENCH_SAMPLE_RATE * benchOptions.seconds / config.blockSize) + 1;
+	std::vector<double> blockNs(numBlocks);
+	uint64_t frame = 0;
+
+	for (unsigned b = 0; b < numWarmup + numBlocks; b++) {
+		const MidiEvent* events = nullptr;
+		uint32_t numEvents = 0;
+		if (config.storm) {
+			events = &stormEvents[(b % BENCH_STORM_BLOCKS) * stormStride];
+			numEvents = stormCounts[b % BENCH_STORM_BLOCKS];
+		}
+
+		if (midiClock) {
+			blockEvents.clear();
+			if (b == 0) {
+				blockEvents.push_back(MidiEvent());
+				setClockEvent(blockEvents.back(), 0, MIDI_START);
+			}
+
+			uint32_t e = 0;
+			while (nextClockFrame < frame + config.blockSize) {
+				const uint32_t clockFrame = static_cast<uint32_t>(nextClockFrame - frame);
+				for (; e < numEvents && events[e].frame < clockFrame; e++) {
+					blockEvents.push_back(events[e]);
+				}
+				blockEvents.push_back(MidiEvent());
+				setClockEvent(blockEvents.back(), clockFrame, MIDI_TIMING_CLOCK);
+				nextClockFrame += clockPeriod;
+			}
+			for (; e < numEvents; e++) {
+				blockEvents.push_back(events[e]);
+			}
+
+			events = blockEvents.data();
+			numEvents = static_cast<uint32_t>(blockEvents.size());
+		}
+
+		const TimePosition position = getPosition(true, frame);
+
+		const BenchClock::time_point start = BenchClock::now();
+
+		arp->transmitHostInfo(position);
+		arp->process(events, numEvents, config.blockSize);
+
+		const double ns = elapsedNs(start);
+
+		if (b >= numWarmup) {
+			blockNs[b - numWarmup] = ns;
+		}
+		frame += config.blockSize;
+	}
+
+	benchSink = benchSink + sink.sum;
+	delete arp;
+
+	double total = 0.0;
+	for (unsigned b = 0; b < numBlocks; b++) {
+		total += blockNs[b];
+	}
+	const double worst = *std::max_element(blockNs.begin(), blockNs.end());
+	std::nth_element(blockNs.begin(), blockNs.begin() + numBlocks * 99 / 100, blockNs.end());
+	const double p99 = blockNs[numBlocks * 99 / 100];
+	const double mean = total / numBlocks;
+
+	BenchResult result(group);
+	result.addConfig("block", static_cast<long>(config.blockSize));
+	result.addConfig("notes", static_cast<long>(config.numNotes));
+	result.addConfig("arp_mode", arpModeNames[config.arpMode]);
+	result.addConfig("octave_mode", octaveModeNames[config.octaveMode]);
+	result.addConfig("sync_mode", syncModeNames[config.syncMode]);
+	result.addConfig("input", config.storm ? "storm" : "held");
+	result.addMetric("ns_per_sample", std::max(0.0, mean - timerOverhead) / config.blockSize);
+	result.addMetric("ns_per_block", mean);
+	result.addMetric("p99_block_ns", p99);
+	result.addMetric("worst_block_ns", worst);
+	addResult(result);
+}
+
+static void benchProcessSuite(double timerOverhead)
+{
+	static const uint32_t blockSizes[] = {1, 16, 64, 256, 1024, 4096};
+	static const int noteCounts[] = {1, 4, 8, 16, 32};
+	const ProcessConfig base = {256, 4, 0, 0, 0, false};
+
+	if (isSelected("process_size")) {
+		for (unsigned b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++) {
+			for (unsigned n = 0; n < sizeof(noteCounts) / sizeof(noteCounts[0]); n++) {
+				ProcessConfig config = base;
+				config.blockSize = blockSizes[b];
+				config.numNotes = noteCounts[n];
+				benchProcess("process_size", config, timerOverhead);
+			}
+		}
+	}
+
+	if (isSelected("process_mode")) {
+		for (int a = 0; a < NUM_ARP_MODES; a++) {
+			for (int o = 0; o < NUM_OCTAVE_MODES; o++) {
+				ProcessConfig config = base;
+				config.numNotes = 8;
+				config.arpMode = a;
+				config.octaveMode = o;
+				benchProcess("process_mode", config, timerOverhead);
+			}
+		}
+	}
+
+	if (isSelected("process_sync")) {
+		for (int s = 0; s < static_cast<int>(sizeof(syncModeNames) / sizeof(syncModeNames[0])); s++) {
+			for (unsigned b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++) {
+				ProcessConfig config = base;
+				config.blockSize = blockSizes[b];
+				config.syncMode = s;
+				benchProcess("process_sync", config, timerOverhead);
+			}
+		}
+	}
+
+	if (isSelected("process_storm")) {
+		for (unsigned b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++) {
+			ProcessConfig config = base;
+			config.blockSize = blockSizes[b];
+			config.storm = true;
+			benchProcess("process_storm", config, timerOverhead);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+// isolated parts of process()
+
+static void benchClock()
+{
+	PluginClock clock;
+	clock.setSampleRate(BENCH_SAMPLE_RATE);
+	clock.setInternalBpmValue(static_cast<float>(BENCH_BPM));
+	clock.setDivision(9);
+	clock.transmitHostInfo(getPosition(false, 0));
+	clock.update(0);
+
+	uint32_t gates = 0;
+	BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_ISOLATED_OPS; n++) {
+		clock.tick();
+		if (clock.getGate()) {
+			gates++;
+			clock.closeGate();
+		}
+	}
+
+	const double tickNs = elapsedNs(start) / BENCH_ISOLATED_OPS;
+
+	// the event driven path, a jump straight to each gate
+	const unsigned numGates = BENCH_ISOLATED_OPS / 100;
+	start = BenchClock::now();
+
+	for (unsigned n = 0; n < numGates; n++) {
+		const uint32_t frames = clock.getFramesUntilGate();
+		clock.advance(frames);
+		clock.tick();
+		if (clock.getGate()) {
+			gates++;
+			clock.closeGate();
+		}
+	}
+
+	const double gateNs = elapsedNs(start) / numGates;
+	benchSink = benchSink + gates;
+
+	BenchResult result("clock");
+	result.addConfig("division", 9L);
+	result.addMetric("ns_per_tick", tickNs);
+	result.addMetric("ns_per_gate_jump", gateNs);
+	addResult(result);
+}
+
+// held notes in pitch order, what ArpUtils::quicksort used to produce
+static void benchKeyboard(int numNotes)
+{
+	KeyboardState keyboard;
+	uint8_t notes[NUM_VOICES];
+	const unsigned numRounds = BENCH_ISOLATED_OPS / 32;
+	uint32_t sum = 0;
+
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned r = 0; r < numRounds; r++) {
+		for (int n = 0; n < numNotes; n++) {
+			keyboard.noteOn(static_cast<uint8_t>((r + n * 37) & 127), 0);
+		}
+		sum += keyboard.getSortedNotes(notes, NUM_VOICES);
+		sum += notes[0];
+		keyboard.clear();
+	}
+
+	const double ns = elapsedNs(start) / numRounds;
+	benchSink = benchSink + sum;
+
+	BenchResult result("keyboard");
+	result.addConfig("notes", static_cast<long>(numNotes));
+	result.addMetric("ns_per_chord", ns);
+	result.addMetric("ns_per_note", ns / numNotes);
+	addResult(result);
+}
+
+// every other frame, for the events that are written in between
+class BenchSource : public MidiEventSource {
+public:
+	BenchSource() : numEvents(0), next(0)
+	{
+		setNoteEvent(event, 0, MIDI_NOTEON, 60, 100);
+	}
+
+	void reset(unsigned numEvents)
+	{
+		this->numEvents = numEvents;
+		next = 0;
+		event.frame = 1;
+	}
+
+	const MidiEvent* peekEvent() override
+	{
+		return (next < numEvents) ? &event : nullptr;
+	}
+
+	void popEvent() override
+	{
+		next++;
+		event.frame = next * 2 + 1;
+	}
+
+private:
+	MidiEvent event;
+	unsigned numEvents;
+	unsigned next;
+};
+
+static void benchMerge(unsigned numEvents)
+{
+	MidiHandler* handler = new MidiHandler();
+	BenchSource source;
+	SumSink sink;
+	handler->setSource(&source);
+	handler->setSink(&sink);
+
+	MidiEvent event;
+	setNoteEvent(event, 0, MIDI_NOTEON, 60, 100);
+
+	const unsigned numRounds = BENCH_ISOLATED_OPS / (numEvents * 4);
+
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned r = 0; r < numRounds; r++) {
+		source.reset(numEvents);
+		for (unsigned e = 0; e < numEvents; e++) {
+			event.frame = e * 2;
+			handler->appendMidiMessage(event);
+		}
+		handler->flush();
+	}
+
+	const double ns = elapsedNs(start) / numRounds;
+	benchSink = benchSink + sink.sum;
+	delete handler;
+
+	BenchResult result("merge");
+	result.addConfig("events_per_side", static_cast<long>(numEvents));
+	result.addMetric("ns_per_block", ns);
+	result.addMetric("ns_per_event", ns / (numEvents * 2));
+	addResult(result);
+}
+
+// steady state with every voice sounding, what the per-frame note-off scan used to do
+static void benchNoteOffs(int numVoices)
+{
+	NoteOffQueue* queue = new NoteOffQueue();
+	NoteOff noteOff;
+	uint64_t frame = 0;
+	uint32_t sum = 0;
+
+	for (int v = 0; v < numVoices; v++) {
+		queue->schedule(static_cast<uint8_t>(v), 0, frame + v);
+	}
+
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_ISOLATED_OPS; n++) {
+		frame = queue->getNextDeadline();
+		while (queue->popDue(frame, noteOff)) {
+			queue->schedule(noteOff.note, noteOff.channel, frame + numVoices);
+			sum += noteOff.note;
+		}
+	}
+
+	const double ns = elapsedNs(start) / BENCH_ISOLATED_OPS;
+	benchSink = benchSink + sum;
+	delete queue;
+
+	BenchResult result("note_offs");
+	result.addConfig("voices", static_cast<long>(numVoices));
+	result.addMetric("ns_per_note_off", ns);
+	addResult(result);
+}
+
+// ---------------------------------------------------------------------------
+// before and after comparisons
+
+enum OutputPath {
+	OUTPUT_COPY = 0,
+	OUTPUT_VIEW,
+	OUTPUT_SINK
+};
+
+// the buffers the output went through before it was written straight to a
+// sink, kept here only to compare against
+struct LegacyMidiBuffer {
+	MidiEvent bufferedEvents[2048];
+	unsigned numBufferedEvents;
+	MidiEvent bufferedMidiThroughEvents[2048];
+	unsigned numBufferedThroughEvents;
+	MidiEvent midiOutputBuffer[2048];
+	unsigned numOutputEvents;
+};
+
+class LegacyBufferSink : public MidiEventSink {
+public:
+	explicit LegacyBufferSink(LegacyMidiBuffer& buffer) : buffer(buffer) {}
+
+	bool writeEvent(const MidiEvent& event) override
+	{
+		if (buffer.numOutputEvents == 2048) {
+			return false;
+		}
+		buffer.midiOutputBuffer[buffer.numOutputEvents++] = event;
+		return true;
+	}
+
+private:
+	LegacyMidiBuffer& buffer;
+};
+
+// stands in for the old by-value getMidiBuffer(), kept out of line like the original call
+static LegacyMidiBuffer __attribute__((noinline)) copyMidiBuffer(const LegacyMidiBuffer& buffer)
+{
+	return buffer;
+}
+
+static double benchOutputPath(uint32_t blockSize, OutputPath path)
+{
+	static LegacyMidiBuffer buffer;
+	LegacyBufferSink bufferSink(buffer);
+	SumSink sink;
+
+	Arpeggiator* arp = new Arpeggiator();
+	arp->setSampleRate(BENCH_SAMPLE_RATE);
+	arp->setBpm(BENCH_BPM);
+	arp->setDivision(12);
+	holdNotes(*arp, 4, blockSize);
+	if (path == OUTPUT_SINK) {
+		arp->setEventSink(&sink);
+	} else {
+		arp->setEventSink(&bufferSink);
+	}
+
+	const unsigned numBlocks = static_cast<unsigned>(BENCH_SAMPLE_RATE * benchOptions.seconds / blockSize) + 1;
+	uint32_t sum = 0;
+
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned b = 0; b < numBlocks; b++) {
+		buffer.numOutputEvents = 0;
+		arp->transmitHostInfo(getPosition(false, 0));
+		arp->process(nullptr, 0, blockSize);
+
+		if (path == OUTPUT_COPY) {
+			const LegacyMidiBuffer copy = copyMidiBuffer(buffer);
+			for (unsigned x = 0; x < copy.numOutputEvents; x++) {
+				sum += copy.midiOutputBuffer[x].data[1];
+			}
+		} else if (path == OUTPUT_VIEW) {
+			for (unsigned x = 0; x < buffer.numOutputEvents; x++) {
+				sum += buffer.midiOutputBuffer[x].data[1];
+			}
+		}
+	}
+
+	const double ns = elapsedNs(start);
+	benchSink = benchSink + sum + sink.sum;
+	delete arp;
+
+	return ns / numBlocks;
+}
+
+static void benchOutput()
+{
+	static const uint32_t blockSizes[] = {16, 64, 256, 1024};
+
+	for (unsigned i = 0; i < sizeof(blockSizes) / sizeof(blockSizes[0]); i++) {
+		BenchResult result("output_path");
+		result.addConfig("block", static_cast<long>(blockSizes[i]));
+		result.addMetric("copy_ns_per_block", benchOutputPath(blockSizes[i], OUTPUT_COPY));
+		result.addMetric("view_ns_per_block", benchOutputPath(blockSizes[i], OUTPUT_VIEW));
+		result.addMetric("sink_ns_per_block", benchOutputPath(blockSizes[i], OUTPUT_SINK));
+		addResult(result);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// pattern engine
+
+// the virtual, heap allocated pattern classes the engine used before, kept
+// here only to compare against. They lived in their own translation unit, so
+// the overrides are kept out of line to get the same indirect call.
+class LegacyPattern {
+public:
+	LegacyPattern() : size(1), step(0), direction(1), range(1) {}
+	virtual ~LegacyPattern() {}
+	void setPatternSize(int size) { this->size = size; }
+	void setCycleRange(int range) { this->range = range; }
+	int getStep() { return step; }
+	virtual void goToNextStep() = 0;
+protected:
+	int size;
+	int step;
+	int direction;
+	int range;
+};
+
+class LegacyPatternUp : public LegacyPattern {
+public:
+	__attribute__((noinline)) void goToNextStep() override
+	{
+		step = (size > 0) ? (step + 1) % size : 0;
+	}
+};
+
+class LegacyPatternUpDown : public LegacyPattern {
+public:
+	__attribute__((noinline)) void goToNextStep() override
+	{
+		if (size > 1) {
+			int nextStep = step + direction;
+			direction = (nextStep >= size) ? -1 : direction;
+			direction = (nextStep < 0) ? 1 : direction;
+			step += direction;
+		} else {
+			step = 0;
+		}
+	}
+};
+
+class LegacyPatternCycle : public LegacyPattern {
+public:
+	LegacyPatternCycle() : tempStep(0) {}
+	__attribute__((noinline)) void goToNextStep() override
+	{
+		if (size >= 1) {
+			int nextStep = tempStep + direction;
+
+			if (range > 0 && size > 0) {
+				if (nextStep >= size) {
+					step = (step + 1) % range;
+				}
+				tempStep = (tempStep + direction) % size;
+			}
+		} else {
+			step = 0;
+			tempStep = 0;
+		}
+	}
+private:
+	int tempStep;
+};
+
+static const uint8_t benchNotes[8] = {48, 52, 55, 59, 60, 64, 67, 71};
+static const char* benchPatternNames[3] = {"up", "updown", "cycle"};
+static const PatternType benchArpTypes[3] = {PATTERN_UP, PATTERN_UP_DOWN, PATTERN_UP};
+static const PatternType benchOctaveTypes[3] = {PATTERN_UP, PATTERN_UP_DOWN, PATTERN_CYCLE};
+
+// the mode is read through a volatile so neither path can be devirtualized
+// or specialized at compile time
+static volatile unsigned benchPatternMode = 0;
+
+// how the engine held its patterns before, one heap object per mode
+struct LegacyPatterns {
+	LegacyPatterns()
+	{
+		arpPattern = new LegacyPattern*[3];
+		arpPattern[0] = new LegacyPatternUp();
+		arpPattern[1] = new LegacyPatternUpDown();
+		arpPattern[2] = new LegacyPatternUp();
+
+		octavePattern = new LegacyPattern*[3];
+		octavePattern[0] = new LegacyPatternUp();
+		octavePattern[1] = new LegacyPatternUpDown();
+		octavePattern[2] = new LegacyPatternCycle();
+	}
+	~LegacyPatterns()
+	{
+		for (unsigned p = 0; p < 3; p++) {
+			delete arpPattern[p];
+			delete octavePattern[p];
+		}
+		delete[] arpPattern;
+		delete[] octavePattern;
+	}
+	LegacyPattern** arpPattern;
+	LegacyPattern** octavePattern;
+};
+
+struct SequencePatterns {
+	Pattern arpPattern;
+	Pattern octavePattern;
+};
+
+// a gate plays a held note an octave up or down the octave pattern, then
+// advances both patterns, like the engine does
+static double benchPatternLegacy(unsigned mode, int size)
+{
+	LegacyPatterns* patterns = new LegacyPatterns();
+	benchPatternMode = mode;
+
+	uint32_t sum = 0;
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_PATTERN_STEPS; n++) {
+		const unsigned m = benchPatternMode;
+		patterns->arpPattern[m]->setPatternSize(size);
+		patterns->octavePattern[m]->setPatternSize(size);
+		patterns->octavePattern[m]->setCycleRange(4);
+
+		const int step = patterns->arpPattern[m]->getStep();
+		sum += benchNotes[step] + patterns->octavePattern[m]->getStep() * 12;
+		patterns->octavePattern[m]->goToNextStep();
+		patterns->arpPattern[m]->goToNextStep();
+	}
+
+	const double ns = elapsedNs(start);
+	benchSink = benchSink + sum;
+	delete patterns;
+
+	return ns / BENCH_PATTERN_STEPS;
+}
+
+static double benchPattern(unsigned mode, int size)
+{
+	SequencePatterns* patterns = new SequencePatterns();
+	static const uint8_t octaves[4] = {0, 12, 24, 36};
+
+	benchPatternMode = mode;
+	patterns->arpPattern.setType(benchArpTypes[mode]);
+	patterns->arpPattern.setValues(benchNotes, size);
+	patterns->octavePattern.setType(benchOctaveTypes[mode]);
+	patterns->octavePattern.setValues(octaves, 4);
+	patterns->octavePattern.setCycleLength(patterns->arpPattern.getLength());
+
+	uint32_t sum = 0;
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_PATTERN_STEPS; n++) {
+		sum += patterns->arpPattern.getNextValue() + patterns->octavePattern.getNextValue();
+	}
+
+	const double ns = elapsedNs(start);
+	benchSink = benchSink + sum;
+	delete patterns;
+
+	return ns / BENCH_PATTERN_STEPS;
+}
+
+static double benchPatternSetupLegacy()
+{
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_PATTERN_SETUPS; n++) {
+		LegacyPatterns* patterns = new LegacyPatterns();
+		benchSink = benchSink + patterns->arpPattern[benchPatternMode]->getStep();
+		delete patterns;
+	}
+
+	return elapsedNs(start) / BENCH_PATTERN_SETUPS;
+}
+
+static double benchPatternSetup()
+{
+	const BenchClock::time_point start = BenchClock::now();
+
+	for (unsigned n = 0; n < BENCH_PATTERN_SETUPS; n++) {
+		SequencePatterns* patterns = new SequencePatterns();
+		benchSink = benchSink + patterns->arpPattern.getLength();
+		delete patterns;
+	}
+
+	return elapsedNs(start) / BENCH_PATTERN_SETUPS;
+}
+
+static void benchPatterns()
+{
+	for (unsigned m = 0; m < 3; m++) {
+		BenchResult result("pattern_gate");
+		result.addConfig("pattern", benchPatternNames[m]);
+		result.addConfig("notes", 8L);
+		result.addMetric("virtual_ns", benchPatternLegacy(m, 8));
+		result.addMetric("sequence_ns", benchPattern(m, 8));
+		addResult(result);
+	}
+
+	BenchResult result("pattern_setup");
+	result.addMetric("virtual_ns", benchPatternSetupLegacy());
+	result.addMetric("sequence_ns", benchPatternSetup());
+	addResult(result);
+}
+
+static void usage(const char* program)
+{
+	fprintf(stderr,
+		"usage: %s [--json] [--seconds S] [--filter GROUP]\n"
+		"\n"
+		"  --json         print every result as one JSON document on stdout\n"
+		"  --seconds S    audio rendered per process() configuration (%.1f)\n"
+		"  --filter GROUP only run groups whose name contains GROUP\n"
+		"\n"
+		"Groups: process_size process_mode process_sync process_storm clock keyboard\n"
+		"        merge note_offs output_path pattern_gate pattern_setup\n",
+		program, BENCH_DEFAULT_SECONDS);
+}
+
+int main(int argc, char** argv)
+{
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--json") == 0) {
+			benchOptions.json = true;
+		} else if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc) {
+			benchOptions.seconds = std::max(0.01, atof(argv[++a]));
+		} else if (strcmp(argv[a], "--filter") == 0 && a + 1 < argc) {
+			benchOptions.filter = argv[++a];
+		} else {
+			usage(argv[0]);
+			return (strcmp(argv[a], "--help") == 0) ? 0 : 1;
+		}
+	}
+
+	const double timerOverhead = measureTimerOverhead();
+
+	benchProcessSuite(timerOverhead);
+
+	if (isSelected("clock")) {
+		benchClock();
+	}
+	if (isSelected("keyboard")) {
+		benchKeyboard(4);
+		benchKeyboard(32);
+	}
+	if (isSelected("merge")) {
+		benchMerge(8);
+		benchMerge(64);
+		benchMerge(512);
+	}
+	if (isSelected("note_offs")) {
+		benchNoteOffs(4);
+		benchNoteOffs(32);
+	}
+	if (isSelected("output_path")) {
+		benchOutput();
+	}
+	if (isSelected("pattern")) {
+		benchPatterns();
+	}
+
+	if (benchOptions.json) {
+		printJson();
+	}
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+#include "../common/clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#define DRIFT_DEFAULT_HOURS 24.0
+#define DRIFT_BLOCK_SIZE 256
+#define DRIFT_TICKS_PER_BEAT 1920.0
+
+static const float sampleRates[] = {44100.f, 48000.f, 96000.f};
+static const float tempos[] = {120.f, 133.f, 97.3f, 174.5f};
+
+// a linear tempo change over some seconds, the tempo holds after it
+struct TempoRamp {
+	double from;
+	double to;
+	double seconds;
+};
+
+static const TempoRamp tempoRamps[] = {{90.0, 180.0, 16.0}, {174.0, 60.0, 8.0}, {120.0, 121.0, 30.0}};
+
+// beats a host seeks to, in between its ticks, forwards and backwards
+static const double seekBeats[] = {37.3141592653, 2.7182818284, 0.5 + 1.0 / 3840.0};
+
+// the full product of two 64-bit values as its high and low halves, built
+// from 32-bit parts so it also runs where there is no 128-bit type
+static void multiply64(uint64_t a, uint64_t b, uint64_t& high, uint64_t& low)
+{
+	const uint64_t a0 = a & 0xFFFFFFFF;
+	const uint64_t a1 = a >> 32;
+	const uint64_t b0 = b & 0xFFFFFFFF;
+	const uint64_t b1 = b >> 32;
+
+	const uint64_t p00 = a0 * b0;
+	const uint64_t p01 = a0 * b1;
+	const uint64_t p10 = a1 * b0;
+	const uint64_t middle = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+
+	low = (middle << 32) | (p00 & 0xFFFFFFFF);
+	high = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (middle >> 32);
+}
+
+static bool isSameRatio(uint64_t numerator1, uint64_t denominator1, uint64_t numerator2, uint64_t denominator2)
+{
+	uint64_t high1, low1, high2, low2;
+	multiply64(numerator1, denominator2, high1, low1);
+	multiply64(numerator2, denominator1, high2, low2);
+
+	return high1 == high2 && low1 == low2;
+}
+
+// the ideal number of frames per step, sampleRate * 60 * beats / bpm, as an
+// exact ratio of the float values the clock is given. The 24-bit mantissas,
+// the division and the exponents together stay well inside 64 bits.
+static void getIdealPeriod(float sampleRate, float bpm, int division, uint64_t& numerator, uint64_t& denominator)
+{
+	int sampleRateExponent, bpmExponent;
+	const uint64_t sampleRateMantissa = static_cast<uint64_t>(ldexp(frexp(sampleRate, &sampleRateExponent), 24));
+	const uint64_t bpmMantissa = static_cast<uint64_t>(ldexp(frexp(bpm, &bpmExponent), 24));
+	const int shift = sampleRateExponent - bpmExponent;
+
+	numerator = sampleRateMantissa * 120 * divisions[division].denominator;
+	denominator = bpmMantissa * divisions[division].numerator;
+
+	if (shift > 0) {
+		numerator <<= shift;
+	} else {
+		denominator <<= -shift;
+	}
+}
+
+// runs the clock the way the arpeggiator does, jumping from gate to gate,
+// and checks every gate against the ideal grid
+static bool checkDrift(float sampleRate, float bpm, int division, int syncMode, double hours)
+{
+	PluginClock clock;
+	clock.setSampleRate(sampleRate);
+	clock.setDivision(division);
+	clock.setSyncMode(syncMode);
+	clock.setInternalBpmValue(bpm);
+	TimePosition position;
+	position.bbt.valid = true;
+	position.bbt.bar = 1;
+	position.bbt.beat = 1;
+	position.bbt.beatsPerBar = 4;
+	position.bbt.beatType = 4;
+	position.bbt.ticksPerBeat = 1920.0;
+	position.bbt.beatsPerMinute = bpm;
+
+	clock.transmitHostInfo(position);
+	clock.update(0);
+
+	uint64_t numerator, denominator;
+	getIdealPeriod(sampleRate, bpm, division, numerator, denominator);
+
+	uint64_t clockNumerator, clockDenominator;
+	clock.getPeriodRatio(clockNumerator, clockDenominator);
+
+	if (!isSameRatio(numerator, denominator, clockNumerator, clockDenominator)) {
+		printf("FAIL %s sr %.0f bpm %.2f division %d: period %llu/%llu, expected %.6f frames\n",
+				syncMode == FREE_RUNNING ? "free" : "host", sampleRate, bpm, division,
+				static_cast<unsigned long long>(clockNumerator), static_cast<unsigned long long>(clockDenominator),
+				static_cast<double>(numerator) / static_cast<double>(denominator));
+		return false;
+	}
+
+	const uint64_t totalFrames = static_cast<uint64_t>(hours * 3600.0 * sampleRate);
+	uint64_t frame = 0;
+	uint64_t gates = 0;
+
+	// the frame of the next step on the ideal grid, gates * numerator / denominator
+	// worked out one step at a time with the remainder carried
+	const uint64_t periodFrames = numerator / denominator;
+	const uint64_t periodRemainder = numerator % denominator;
+	uint64_t expected = 0;
+	uint64_t remainder = 0;
+
+	while (frame < totalFrames) {
+		const uint32_t frames = clock.getFramesUntilGate();
+		clock.advance(frames);
+		frame += frames;
+
+		clock.tick();
+		if (clock.getGate()) {
+			clock.closeGate();
+
+			if (frame != expected) {
+				printf("FAIL %s sr %.0f bpm %.2f division %d: step %llu at frame %llu, expected %llu\n",
+						syncMode == FREE_RUNNING ? "free" : "host", sampleRate, bpm, division,
+						static_cast<unsigned long long>(gates), static_cast<unsigned long long>(frame),
+						static_cast<unsigned long long>(expected));
+				return false;
+			}
+			gates++;
+
+			expected += periodFrames;
+			remainder += periodRemainder;
+			if (remainder >= denominator) {
+				remainder -= denominator;
+				expected++;
+			}
+		}
+		frame++;
+	}
+
+	return true;
+}
+
+// the position a host in 4/4 reports on the given beat
+static void setHostPosition(TimePosition& position, uint64_t frame, double beats, double bpm)
+{
+	const int64_t wholeBeats = static_cast<int64_t>(beats);
+
+	position.playing = true;
+	position.frame = frame;
+	position.bbt.valid = true;
+	position.bbt.bar = static_cast<int32_t>(wholeBeats / 4 + 1);
+	position.bbt.beat = static_cast<int32_t>(wholeBeats % 4 + 1);
+	position.bbt.barBeat = static_cast<float>(wholeBeats % 4 + (beats - wholeBeats));
+	position.bbt.tick = static_cast<int32_t>((beats - wholeBeats) * DRIFT_TICKS_PER_BEAT);
+	position.bbt.beatsPerBar = 4;
+	position.bbt.beatType = 4;
+	position.bbt.ticksPerBeat = DRIFT_TICKS_PER_BEAT;
+	position.bbt.beatsPerMinute = bpm;
+}
+
+static double getRampBpm(const TempoRamp& ramp, double sampleRate, double frame)
+{
+	const double rampFrames = ramp.seconds * sampleRate;
+
+	return (frame < rampFrames) ? ramp.from + (ramp.to - ramp.from) * frame / rampFrames : ramp.to;
+}
+
+// the beats a host has played by the given frame, the integral of the tempo
+static double getRampBeats(const TempoRamp& ramp, double sampleRate, double frame)
+{
+	const double rampFrames = ramp.seconds * sampleRate;
+	const double framesPerMinute = 60.0 * sampleRate;
+
+	if (frame < rampFrames) {
+		return (ramp.from * frame + (ramp.to - ramp.from) * frame * frame / (2.0 * rampFrames)) / framesPerMinute;
+	}
+
+	return ((ramp.from + ramp.to) * 0.5 * rampFrames + ramp.to * (frame - rampFrames)) / framesPerMinute;
+}
+
+// a host going through a tempo ramp, reporting its position once per block.
+// Steps start on the frame the ramp crosses into them, the ramp is only seen
+// a block late where it starts and stops so one frame off is allowed there.
+static bool checkRamp(float sampleRate, const TempoRamp& ramp, int division, int syncMode, uint64_t& numSteps, uint64_t& numExact)
+{
+	PluginClock clock;
+	clock.setSampleRate(sampleRate);
+	clock.setDivision(division);
+	clock.setSyncMode(syncMode);
+
+	const double stepLength = 2.0 * divisions[division].denominator / divisions[division].numerator;
+	const uint64_t totalFrames = static_cast<uint64_t>((ramp.seconds + 4.0) * sampleRate);
+	uint64_t gates = 0;
+
+	for (uint64_t blockStart = 0; blockStart < totalFrames; blockStart += DRIFT_BLOCK_SIZE) {
+		TimePosition position;
+		setHostPosition(position, blockStart, getRampBeats(ramp, sampleRate, blockStart), getRampBpm(ramp, sampleRate, blockStart));
+
+		clock.transmitHostInfo(position);
+		clock.update(DRIFT_BLOCK_SIZE);
+
+		uint32_t s = 0;
+		while (true) {
+			const uint32_t frames = std::min(clock.getFramesUntilGate(), DRIFT_BLOCK_SIZE - s);
+			clock.advance(frames);
+			s += frames;
+			if (s == DRIFT_BLOCK_SIZE) {
+				break;
+			}
+
+			clock.tick();
+			if (clock.getGate()) {
+				clock.closeGate();
+
+				const double frame = static_cast<double>(blockStart + s);
+				const double framesPerBeat = 60.0 * sampleRate / getRampBpm(ramp, sampleRate, frame);
+				const double crossing = frame - (getRampBeats(ramp, sampleRate, frame) - gates * stepLength) * framesPerBeat;
+				const double error = frame - floor(crossing + 1e-4);
+
+				if (fabs(error) > 1.0) {
+					printf("FAIL %s sr %.0f ramp %.0f-%.0f bpm division %d: step %llu at frame %.0f, expected %.0f\n",
+							syncMode == HOST_BPM_SYNC ? "host" : "quantized", sampleRate, ramp.from, ramp.to, division,
+							static_cast<unsigned long long>(gates), frame, floor(crossing + 1e-4));
+					return false;
+				}
+				numExact += (error == 0.0) ? 1 : 0;
+				numSteps++;
+				gates++;
+			}
+			s++;
+		}
+	}
+
+	return true;
+}
+
+// a host that seeks in between its ticks after a second of playing, the
+// steps have to carry on from the exact position it lands on
+static bool checkSeek(float sampleRate, float bpm, double targetBeats, int division, uint64_t& numSteps, uint64_t& numExact)
+{
+	PluginClock clock;
+	clock.setSampleRate(sampleRate);
+	clock.setDivision(division);
+	clock.setSyncMode(HOST_QUANTIZED_SYNC);
+
+	const double stepLength = 2.0 * divisions[division].denominator / divisions[division].numerator;
+	const double framesPerBeat = 60.0 * sampleRate / bpm;
+	const uint64_t seekFrame = (static_cast<uint64_t>(sampleRate) / DRIFT_BLOCK_SIZE + 1) * DRIFT_BLOCK_SIZE;
+	const uint64_t totalFrames = seekFrame + static_cast<uint64_t>(4.0 * sampleRate);
+	const uint64_t hostSeekFrame = static_cast<uint64_t>(llround(targetBeats * framesPerBeat));
+
+	// the first step that starts after the host landed
+	int64_t step = static_cast<int64_t>(floor(targetBeats / stepLength)) + 1;
+
+	for (uint64_t blockStart = 0; blockStart < totalFrames; blockStart += DRIFT_BLOCK_SIZE) {
+		TimePosition position;
+		if (blockStart < seekFrame) {
+			setHostPosition(position, blockStart, blockStart / framesPerBeat, bpm);
+		} else {
+			const uint64_t played = blockStart - seekFrame;
+			setHostPosition(position, hostSeekFrame + played, targetBeats + played / framesPerBeat, bpm);
+		}
+
+		clock.transmitHostInfo(position);
+		clock.update(DRIFT_BLOCK_SIZE);
+
+		uint32_t s = 0;
+		while (true) {
+			const uint32_t frames = std::min(clock.getFramesUntilGate(), DRIFT_BLOCK_SIZE - s);
+			clock.advance(frames);
+			s += frames;
+			if (s == DRIFT_BLOCK_SIZE) {
+				break;
+			}
+
+			clock.tick();
+			if (clock.getGate()) {
+				clock.closeGate();
+
+				// landing early in a step plays it straight away
+				const uint64_t frame = blockStart + s;
+				if (frame > seekFrame) {
+					const double crossing = seekFrame + (step * stepLength - targetBeats) * framesPerBeat;
+					const double error = frame - floor(crossing + 1e-4);
+
+					if (fabs(error) > 1.0) {
+						printf("FAIL seek sr %.0f bpm %.1f to beat %.4f division %d: step %lld at frame %llu, expected %.0f\n",
+								sampleRate, bpm, targetBeats, division, static_cast<long long>(step),
+								static_cast<unsigned long long>(frame), floor(crossing + 1e-4));
+						return false;
+					}
+					numExact += (error == 0.0) ? 1 : 0;
+					numSteps++;
+					step++;
+				}
+			}
+			s++;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const double hours = (argc > 1) ? atof(argv[1]) : DRIFT_DEFAULT_HOURS;
+
+	if (hours <= 0.0) {
+		fprintf(stderr, "usage: %s [hours]\n", argv[0]);
+		return 1;
+	}
+
+	const int syncModes[] = {FREE_RUNNING, HOST_BPM_SYNC};
+	unsigned runs = 0;
+	unsigned failures = 0;
+
+	for (unsigned m = 0; m < sizeof(syncModes) / sizeof(syncModes[0]); m++) {
+		for (unsigned s = 0; s < sizeof(sampleRates) / sizeof(sampleRates[0]); s++) {
+			for (unsigned t = 0; t < sizeof(tempos) / sizeof(tempos[0]); t++) {
+				for (int d = 0; d < NUM_DIVISIONS; d++) {
+					if (!checkDrift(sampleRates[s], tempos[t], d, syncModes[m], hours)) {
+						failures++;
+					}
+					runs++;
+				}
+			}
+		}
+	}
+
+	printf("%u of %u clock runs stayed on the grid for %.1f hours\n", runs - failures, runs, hours);
+
+	const int rampSyncModes[] = {HOST_BPM_SYNC, HOST_QUANTIZED_SYNC};
+	unsigned rampRuns = 0;
+	unsigned rampFailures = 0;
+	uint64_t numSteps = 0;
+	uint64_t numExact = 0;
+
+	for (unsigned m = 0; m < sizeof(rampSyncModes) / sizeof(rampSyncModes[0]); m++) {
+		for (unsigned s = 0; s < sizeof(sampleRates) / sizeof(sampleRates[0]); s++) {
+			for (unsigned r = 0; r < sizeof(tempoRamps) / sizeof(tempoRamps[0]); r++) {
+				for (int d = 0; d < NUM_DIVISIONS; d++) {
+					if (!checkRamp(sampleRates[s], tempoRamps[r], d, rampSyncModes[m], numSteps, numExact)) {
+						rampFailures++;
+					}
+					rampRuns++;
+				}
+			}
+		}
+	}
+
+	printf("%u of %u tempo ramp runs followed the host, %.2f%% of the steps on the exact frame\n",
+			rampRuns - rampFailures, rampRuns, (numSteps > 0) ? 100.0 * numExact / numSteps : 0.0);
+
+	unsigned seekRuns = 0;
+	unsigned seekFailures = 0;
+	numSteps = 0;
+	numExact = 0;
+
+	for (unsigned s = 0; s < sizeof(sampleRates) / sizeof(sampleRates[0]); s++) {
+		for (unsigned t = 0; t < sizeof(tempos) / sizeof(tempos[0]); t++) {
+			for (unsigned b = 0; b < sizeof(seekBeats) / sizeof(seekBeats[0]); b++) {
+				for (int d = 0; d < NUM_DIVISIONS; d++) {
+					if (!checkSeek(sampleRates[s], tempos[t], seekBeats[b], d, numSteps, numExact)) {
+						seekFailures++;
+					}
+					seekRuns++;
+				}
+			}
+		}
+	}
+
+	printf("%u of %u seek runs carried on from the host position, %.2f%% of the steps on the exact frame\n",
+			seekRuns - seekFailures, seekRuns, (numSteps > 0) ? 100.0 * numExact / numSteps : 0.0);
+
+	return (failures == 0 && rampFailures == 0 && seekFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#include "../common/divisions.hpp"
+
+#include <cstdio>
+
+// prints the scale points of the Divisions port, to paste into the ttl
+// whenever the division table changes
+int main()
+{
+	printf("        lv2:maximum %d ;\n", NUM_DIVISIONS - 1);
+	printf("        lv2:portProperty lv2:enumeration ;\n");
+	printf("        lv2:scalePoint [\n");
+
+	for (int i = 0; i < NUM_DIVISIONS; i++) {
+		if (i > 0) {
+			printf("        [\n");
+		}
+		printf("            rdfs:label  \"\"\"%s\"\"\" ;\n", divisions[i].label);
+		printf("            rdf:value %d ;\n", i);
+		printf("        ]%s\n", (i < NUM_DIVISIONS - 1) ? " ," : " ;");
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include "jitterReport.hpp"
+#include "../common/clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define JITTER_BAR_WIDTH 40
+
+static const char* const syncModeNames[] = {"free running", "host bpm", "host quantized", "midi clock"};
+
+JitterReport::JitterReport(double sampleRate, uint64_t totalFrames) :
+	sampleRate(sampleRate),
+	totalFrames(std::max<uint64_t>(totalFrames, 1))
+{
+}
+
+JitterReport::~JitterReport()
+{
+}
+
+JitterGroup& JitterReport::getGroup(int syncMode, int division)
+{
+	for (JitterGroup& group : groups) {
+		if (group.syncMode == syncMode && group.division == division) {
+			return group;
+		}
+	}
+
+	JitterGroup group;
+	memset(&group, 0, sizeof(group));
+	group.syncMode = syncMode;
+	group.division = division;
+	group.minError = HUGE_VAL;
+	group.maxError = -HUGE_VAL;
+	groups.push_back(group);
+
+	return groups.back();
+}
+
+void JitterReport::add(const GateRecord& record)
+{
+	JitterGroup& group = getGroup(record.syncMode, record.division);
+	const double error = record.error;
+	const double seconds = record.frame / sampleRate;
+
+	group.numGates++;
+	group.sum += error;
+	group.sumSquares += error * error;
+	group.minError = std::min(group.minError, error);
+	group.maxError = std::max(group.maxError, error);
+
+	// the first and last bin take everything outside the histogram
+	const double bin = floor(error / JITTER_BIN_FRAMES) + JITTER_NUM_BINS / 2 + 1;
+	group.bins[static_cast<int>(std::min(std::max(bin, 0.0), JITTER_NUM_BINS + 1.0))]++;
+
+	const uint64_t slice = std::min<uint64_t>(record.frame * JITTER_NUM_SLICES / totalFrames, JITTER_NUM_SLICES - 1);
+	group.sliceGates[slice]++;
+	group.sliceSum[slice] += error;
+	group.sliceWorst[slice] = std::max(group.sliceWorst[slice], fabs(error));
+
+	group.sumSeconds += seconds;
+	group.sumSecondsSquared += seconds * seconds;
+	group.sumSecondsError += seconds * error;
+}
+
+void JitterReport::printGroup(FILE* file, const JitterGroup& group) const
+{
+	const double mean = group.sum / group.numGates;
+	const double rms = sqrt(group.sumSquares / group.numGates);
+	const char* const syncMode = (group.syncMode >= 0 && group.syncMode <= MIDI_CLOCK_SYNC) ? syncModeNames[group.syncMode] : "?";
+	const char* const division = (group.division >= 0 && group.division < NUM_DIVISIONS) ? divisions[group.division].label : "?";
+
+	fprintf(file, "gate timing, %s sync, division %s: %llu gates, mean %+.3f, rms %.3f, from %+.3f to %+.3f frames\n",
+			syncMode, division, static_cast<unsigned long long>(group.numGates), mean, rms, group.minError, group.maxError);
+
+	const uint64_t maxCount = *std::max_element(group.bins, group.bins + JITTER_NUM_BINS + 2);
+
+	fprintf(file, "  jitter in frames\n");
+	for (int b = 0; b < JITTER_NUM_BINS + 2; b++) {
+		const double from = (b - JITTER_NUM_BINS / 2 - 1) * JITTER_BIN_FRAMES;
+		const int width = static_cast<int>(group.bins[b] * JITTER_BAR_WIDTH / maxCount);
+
+		if (b == 0) {
+			fprintf(file, "    %17s %+6.2f", "below", from + JITTER_BIN_FRAMES);
+		} else if (b == JITTER_NUM_BINS + 1) {
+			fprintf(file, "    %17s %+6.2f", "from", from);
+		} else {
+			fprintf(file, "    %+6.2f .. %+6.2f      ", from, from + JITTER_BIN_FRAMES);
+		}
+		fprintf(file, " %10llu %.*s\n", static_cast<unsigned long long>(group.bins[b]), width,
+				"########################################");
+	}
+
+	fprintf(file, "  drift over the run\n");
+	for (int s = 0; s < JITTER_NUM_SLICES; s++) {
+		if (group.sliceGates[s] == 0) {
+			continue;
+		}
+		fprintf(file, "    %9.1f - %9.1f s  mean %+.3f  worst %.3f frames\n",
+				static_cast<double>(totalFrames) * s / JITTER_NUM_SLICES / sampleRate,
+				static_cast<double>(totalFrames) * (s + 1) / JITTER_NUM_SLICES / sampleRate,
+				group.sliceSum[s] / group.sliceGates[s], group.sliceWorst[s]);
+	}
+
+	const double n = static_cast<double>(group.numGates);
+	const double variance = n * group.sumSecondsSquared - group.sumSeconds * group.sumSeconds;
+	if (group.numGates > 1 && variance > 0.0) {
+		const double slope = (n * group.sumSecondsError - group.sumSeconds * group.sum) / variance;
+		fprintf(file, "  drift %+.6f frames per hour\n", slope * 3600.0);
+	}
+}
+
+void JitterReport::print(FILE* file) const
+{
+	if (groups.empty()) {
+		fprintf(file, "no gates were logged\n");
+		return;
+	}
+
+	for (const JitterGroup& group : groups) {
+		printGroup(file, group);
+	}
+}
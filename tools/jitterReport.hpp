@@ -0,0 +1,52 @@
+#ifndef _H_JITTER_REPORT_
+#define _H_JITTER_REPORT_
+
+#include "../common/gateLog.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#define JITTER_BIN_FRAMES 0.25
+#define JITTER_NUM_BINS 16
+#define JITTER_NUM_SLICES 10
+
+// the gates of one sync mode and division, the error in frames as a
+// histogram and as it goes over the length of the run
+struct JitterGroup {
+	int syncMode;
+	int division;
+	uint64_t numGates;
+	double sum;
+	double sumSquares;
+	double minError;
+	double maxError;
+	uint64_t bins[JITTER_NUM_BINS + 2];
+	uint64_t sliceGates[JITTER_NUM_SLICES];
+	double sliceSum[JITTER_NUM_SLICES];
+	double sliceWorst[JITTER_NUM_SLICES];
+
+	// least squares line through error over time, its slope is the drift
+	double sumSeconds;
+	double sumSecondsSquared;
+	double sumSecondsError;
+};
+
+// Collects the gate timings an instrumented clock logged, and prints them
+// per sync mode and division.
+class JitterReport {
+public:
+	JitterReport(double sampleRate, uint64_t totalFrames);
+	~JitterReport();
+	void add(const GateRecord& record);
+	void print(FILE* file) const;
+private:
+	JitterGroup& getGroup(int syncMode, int division);
+	void printGroup(FILE* file, const JitterGroup& group) const;
+
+	double sampleRate;
+	uint64_t totalFrames;
+	std::vector<JitterGroup> groups;
+};
+
+#endif //_H_JITTER_REPORT_
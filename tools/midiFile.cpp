@@ -0,0 +1,465 @@
+#include "midiFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static bool readVariableLength(const uint8_t* data, uint32_t size, uint32_t& pos, uint32_t& value)
+{
+	value = 0;
+
+	for (unsigned n = 0; n < 4; n++) {
+		if (pos >= size) {
+			return false;
+		}
+		const uint8_t byte = data[pos++];
+		value = (value << 7) | (byte & 0x7F);
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void writeVariableLength(std::vector<uint8_t>& out, uint32_t value)
+{
+	uint8_t bytes[4];
+	unsigned count = 0;
+
+	do {
+		bytes[count++] = value & 0x7F;
+		value >>= 7;
+	} while (value != 0 && count < 4);
+
+	while (count > 0) {
+		count--;
+		out.push_back(bytes[count] | ((count > 0) ? 0x80 : 0));
+	}
+}
+
+static uint32_t readBigEndian(const uint8_t* data, unsigned numBytes)
+{
+	uint32_t value = 0;
+
+	for (unsigned n = 0; n < numBytes; n++) {
+		value = (value << 8) | data[n];
+	}
+
+	return value;
+}
+
+static void writeBigEndian(std::vector<uint8_t>& out, uint32_t value, unsigned numBytes)
+{
+	for (unsigned n = numBytes; n > 0; n--) {
+		out.push_back((value >> ((n - 1) * 8)) & 0xFF);
+	}
+}
+
+static bool compareEventTicks(const MidiFileEvent& a, const MidiFileEvent& b)
+{
+	return a.tick < b.tick;
+}
+
+// the timeline always starts with an entry at tick 0, so upper_bound never returns the first one
+static bool compareTickToTempo(uint64_t tick, const MidiFileTempo& tempo)
+{
+	return tick < tempo.tick;
+}
+
+static bool compareSecondsToTempo(double seconds, const MidiFileTempo& tempo)
+{
+	return seconds < tempo.seconds;
+}
+
+static bool compareTicksToTimeSignature(double ticks, const MidiFileTimeSignature& signature)
+{
+	return ticks < signature.tick;
+}
+
+MidiFile::MidiFile() : division(MIDI_FILE_DEFAULT_DIVISION), smpteTicksPerSecond(0.0)
+{
+	updateTimeline();
+}
+
+MidiFile::~MidiFile()
+{
+}
+
+bool MidiFile::load(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+
+	if (file == nullptr) {
+		fprintf(stderr, "%s: cannot open file\n", path);
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t chunk[4096];
+	size_t numRead;
+
+	while ((numRead = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		data.insert(data.end(), chunk, chunk + numRead);
+	}
+	fclose(file);
+
+	if (data.size() < 14 || memcmp(data.data(), "MThd", 4) != 0) {
+		fprintf(stderr, "%s: not a standard MIDI file\n", path);
+		return false;
+	}
+
+	const uint32_t headerSize = readBigEndian(data.data() + 4, 4);
+	division = static_cast<uint16_t>(readBigEndian(data.data() + 12, 2));
+
+	if (headerSize < 6 || division == 0) {
+		fprintf(stderr, "%s: invalid header\n", path);
+		return false;
+	}
+
+	// SMPTE division, ticks are a fixed fraction of a second and tempo changes do not apply
+	if (division & 0x8000) {
+		const int framesPerSecond = -static_cast<int8_t>(division >> 8);
+		const double rate = (framesPerSecond == 29) ? 29.97 : static_cast<double>(framesPerSecond);
+		smpteTicksPerSecond = rate * (division & 0xFF);
+	} else {
+		smpteTicksPerSecond = 0.0;
+	}
+
+	events.clear();
+	tempos.clear();
+	timeSignatures.clear();
+
+	size_t offset = 8 + static_cast<size_t>(headerSize);
+
+	while (offset + 8 <= data.size()) {
+		const uint32_t chunkSize = readBigEndian(data.data() + offset + 4, 4);
+		const uint8_t* chunkData = data.data() + offset + 8;
+
+		if (offset + 8 + chunkSize > data.size()) {
+			fprintf(stderr, "%s: truncated chunk\n", path);
+			return false;
+		}
+		if (memcmp(data.data() + offset, "MTrk", 4) == 0 && !parseTrack(chunkData, chunkSize)) {
+			fprintf(stderr, "%s: invalid track data\n", path);
+			return false;
+		}
+
+		offset += 8 + chunkSize;
+	}
+
+	// tracks are merged, events on the same tick keep their track order
+	std::stable_sort(events.begin(), events.end(), compareEventTicks);
+	updateTimeline();
+
+	return true;
+}
+
+bool MidiFile::parseTrack(const uint8_t* data, uint32_t size)
+{
+	uint32_t pos = 0;
+	uint64_t tick = 0;
+	uint8_t runningStatus = 0;
+
+	while (pos < size) {
+		uint32_t delta;
+		if (!readVariableLength(data, size, pos, delta) || pos >= size) {
+			return false;
+		}
+		tick += delta;
+
+		uint8_t status = data[pos];
+		if (status & 0x80) {
+			pos++;
+		} else if (runningStatus != 0) {
+			status = runningStatus;
+		} else {
+			return false;
+		}
+
+		if (status == 0xFF) {
+			if (pos >= size) {
+				return false;
+			}
+			const uint8_t type = data[pos++];
+			uint32_t length;
+			if (!readVariableLength(data, size, pos, length) || pos + length > size) {
+				return false;
+			}
+
+			if (type == 0x51 && length == 3) {
+				addTempo(tick, readBigEndian(data + pos, 3));
+			} else if (type == 0x58 && length >= 2) {
+				addTimeSignature(tick, data[pos], static_cast<uint8_t>(1 << std::min<uint8_t>(data[pos + 1], 6)));
+			} else if (type == 0x2F) {
+				return true;
+			}
+
+			pos += length;
+		} else if (status == 0xF0 || status == 0xF7) {
+			// sysex is not passed to the arpeggiator, it also cancels running status
+			uint32_t length;
+			if (!readVariableLength(data, size, pos, length) || pos + length > size) {
+				return false;
+			}
+			pos += length;
+			runningStatus = 0;
+		} else if (status < 0xF0) {
+			const uint8_t numDataBytes = ((status & 0xE0) == 0xC0) ? 1 : 2;
+			if (pos + numDataBytes > size) {
+				return false;
+			}
+
+			uint8_t message[3] = {status, data[pos], 0};
+			if (numDataBytes == 2) {
+				message[2] = data[pos + 1];
+			}
+			addEvent(tick, message, numDataBytes + 1);
+
+			pos += numDataBytes;
+			runningStatus = status;
+		} else {
+			// system common messages do not belong in a file
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// writes a format 0 file with the tempo map and time signatures this file was given
+bool MidiFile::save(const char* path) const
+{
+	std::vector<uint8_t> track;
+	uint64_t previousTick = 0;
+	size_t t = 0, s = 0, e = 0;
+
+	while (t < tempos.size() || s < timeSignatures.size() || e < events.size()) {
+		const uint64_t tempoTick = (t < tempos.size()) ? tempos[t].tick : UINT64_MAX;
+		const uint64_t signatureTick = (s < timeSignatures.size()) ? timeSignatures[s].tick : UINT64_MAX;
+		const uint64_t eventTick = (e < events.size()) ? events[e].tick : UINT64_MAX;
+		const uint64_t tick = std::min(tempoTick, std::min(signatureTick, eventTick));
+
+		writeVariableLength(track, static_cast<uint32_t>(std::min<uint64_t>(tick - previousTick, 0x0FFFFFFF)));
+		previousTick = tick;
+
+		if (tick == tempoTick) {
+			track.push_back(0xFF);
+			track.push_back(0x51);
+			track.push_back(3);
+			writeBigEndian(track, tempos[t++].microsPerQuarter, 3);
+		} else if (tick == signatureTick) {
+			const MidiFileTimeSignature& signature = timeSignatures[s++];
+			uint8_t power = 0;
+			while ((1 << power) < signature.denominator) {
+				power++;
+			}
+			track.push_back(0xFF);
+			track.push_back(0x58);
+			track.push_back(4);
+			track.push_back(signature.numerator);
+			track.push_back(power);
+			track.push_back(24);
+			track.push_back(8);
+		} else {
+			const MidiFileEvent& event = events[e++];
+			track.insert(track.end(), event.data, event.data + event.size);
+		}
+	}
+
+	writeVariableLength(track, 0);
+	track.push_back(0xFF);
+	track.push_back(0x2F);
+	track.push_back(0);
+
+	std::vector<uint8_t> data;
+	data.insert(data.end(), {'M', 'T', 'h', 'd'});
+	writeBigEndian(data, 6, 4);
+	writeBigEndian(data, 0, 2);
+	writeBigEndian(data, 1, 2);
+	writeBigEndian(data, division, 2);
+	data.insert(data.end(), {'M', 'T', 'r', 'k'});
+	writeBigEndian(data, static_cast<uint32_t>(track.size()), 4);
+	data.insert(data.end(), track.begin(), track.end());
+
+	FILE* file = fopen(path, "wb");
+
+	if (file == nullptr) {
+		fprintf(stderr, "%s: cannot create file\n", path);
+		return false;
+	}
+
+	const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	if (!written) {
+		fprintf(stderr, "%s: write failed\n", path);
+	}
+
+	return written;
+}
+
+void MidiFile::copyTimeline(const MidiFile& other)
+{
+	division = other.division;
+	smpteTicksPerSecond = other.smpteTicksPerSecond;
+	tempos = other.tempos;
+	timeSignatures = other.timeSignatures;
+	events.clear();
+}
+
+void MidiFile::addEvent(uint64_t tick, const uint8_t* data, uint8_t size)
+{
+	MidiFileEvent event;
+
+	event.tick = tick;
+	event.size = std::min<uint8_t>(size, 3);
+	memcpy(event.data, data, event.size);
+
+	events.push_back(event);
+}
+
+uint16_t MidiFile::getDivision() const
+{
+	return division;
+}
+
+const std::vector<MidiFileEvent>& MidiFile::getEvents() const
+{
+	return events;
+}
+
+double MidiFile::getSeconds(uint64_t tick) const
+{
+	if (smpteTicksPerSecond > 0.0) {
+		return tick / smpteTicksPerSecond;
+	}
+
+	const size_t t = std::upper_bound(tempos.begin(), tempos.end(), tick, compareTickToTempo) - tempos.begin() - 1;
+
+	return tempos[t].seconds + (tick - tempos[t].tick) * (tempos[t].microsPerQuarter / 1000000.0) / division;
+}
+
+double MidiFile::getTicks(double seconds) const
+{
+	if (smpteTicksPerSecond > 0.0) {
+		return seconds * smpteTicksPerSecond;
+	}
+
+	const MidiFileTempo& tempo = getTempoAtSeconds(seconds);
+
+	return tempo.tick + (seconds - tempo.seconds) * division * (1000000.0 / tempo.microsPerQuarter);
+}
+
+// in quarter notes per minute
+double MidiFile::getBpm(double seconds) const
+{
+	if (smpteTicksPerSecond > 0.0) {
+		return 60000000.0 / MIDI_FILE_DEFAULT_TEMPO;
+	}
+
+	return 60000000.0 / getTempoAtSeconds(seconds).microsPerQuarter;
+}
+
+// SMPTE files have no tempo, a quarter note lasts as long as at the default one
+double MidiFile::getQuarterTicks() const
+{
+	if (smpteTicksPerSecond > 0.0) {
+		return smpteTicksPerSecond * (MIDI_FILE_DEFAULT_TEMPO / 1000000.0);
+	}
+
+	return static_cast<double>(division);
+}
+
+// the bar and the position in it, in beats of the time signature denominator
+void MidiFile::getBarBeat(double seconds, int64_t& bar, double& barBeat, uint8_t& beatsPerBar, uint8_t& beatType) const
+{
+	const double ticks = getTicks(seconds);
+	const double quarterTicks = getQuarterTicks();
+
+	const size_t s = std::upper_bound(timeSignatures.begin(), timeSignatures.end(), ticks, compareTicksToTimeSignature) - timeSignatures.begin() - 1;
+
+	const MidiFileTimeSignature& signature = timeSignatures[s];
+	const double beats = (ticks - signature.tick) / (quarterTicks * 4.0 / signature.denominator);
+	const double barsIn = floor(beats / signature.numerator);
+
+	bar = signature.bar + static_cast<int64_t>(barsIn);
+	barBeat = beats - barsIn * signature.numerator;
+	beatsPerBar = signature.numerator;
+	beatType = signature.denominator;
+}
+
+void MidiFile::addTempo(uint64_t tick, uint32_t microsPerQuarter)
+{
+	MidiFileTempo tempo;
+
+	tempo.tick = tick;
+	tempo.microsPerQuarter = (microsPerQuarter > 0) ? microsPerQuarter : MIDI_FILE_DEFAULT_TEMPO;
+	tempo.seconds = 0.0;
+
+	tempos.push_back(tempo);
+}
+
+void MidiFile::addTimeSignature(uint64_t tick, uint8_t numerator, uint8_t denominator)
+{
+	MidiFileTimeSignature signature;
+
+	signature.tick = tick;
+	signature.numerator = (numerator > 0) ? numerator : 4;
+	signature.denominator = denominator;
+	signature.bar = 0;
+
+	timeSignatures.push_back(signature);
+}
+
+static bool compareTempoTicks(const MidiFileTempo& a, const MidiFileTempo& b)
+{
+	return a.tick < b.tick;
+}
+
+static bool compareTimeSignatureTicks(const MidiFileTimeSignature& a, const MidiFileTimeSignature& b)
+{
+	return a.tick < b.tick;
+}
+
+// sorts the tempo and time signature changes, with 120 bpm 4/4 from the start
+// when the file does not say otherwise, and works out where each one falls
+void MidiFile::updateTimeline()
+{
+	std::stable_sort(tempos.begin(), tempos.end(), compareTempoTicks);
+	std::stable_sort(timeSignatures.begin(), timeSignatures.end(), compareTimeSignatureTicks);
+
+	if (tempos.empty() || tempos.front().tick > 0) {
+		addTempo(0, MIDI_FILE_DEFAULT_TEMPO);
+		std::stable_sort(tempos.begin(), tempos.end(), compareTempoTicks);
+	}
+	if (timeSignatures.empty() || timeSignatures.front().tick > 0) {
+		addTimeSignature(0, 4, 4);
+		std::stable_sort(timeSignatures.begin(), timeSignatures.end(), compareTimeSignatureTicks);
+	}
+
+	const double quarterTicks = getQuarterTicks();
+
+	tempos[0].seconds = 0.0;
+	for (size_t t = 1; t < tempos.size(); t++) {
+		const uint64_t ticks = tempos[t].tick - tempos[t - 1].tick;
+		tempos[t].seconds = tempos[t - 1].seconds + ticks * (tempos[t - 1].microsPerQuarter / 1000000.0) / quarterTicks;
+	}
+
+	// a change in the middle of a bar starts a new one
+	timeSignatures[0].bar = 0;
+	for (size_t s = 1; s < timeSignatures.size(); s++) {
+		const MidiFileTimeSignature& previous = timeSignatures[s - 1];
+		const double barTicks = quarterTicks * 4.0 * previous.numerator / previous.denominator;
+		const double bars = ceil((timeSignatures[s].tick - previous.tick) / barTicks);
+		timeSignatures[s].bar = previous.bar + static_cast<int64_t>(bars);
+	}
+}
+
+const MidiFileTempo& MidiFile::getTempoAtSeconds(double seconds) const
+{
+	const size_t t = std::upper_bound(tempos.begin(), tempos.end(), seconds, compareSecondsToTempo) - tempos.begin() - 1;
+
+	return tempos[t];
+}
@@ -0,0 +1,62 @@
+#ifndef _H_MIDI_FILE_
+#define _H_MIDI_FILE_
+
+#include <cstdint>
+#include <vector>
+
+#define MIDI_FILE_DEFAULT_DIVISION 480
+#define MIDI_FILE_DEFAULT_TEMPO 500000
+
+struct MidiFileEvent {
+	uint64_t tick;
+	uint8_t size;
+	uint8_t data[3];
+};
+
+struct MidiFileTempo {
+	uint64_t tick;
+	uint32_t microsPerQuarter;
+	double seconds;
+};
+
+struct MidiFileTimeSignature {
+	uint64_t tick;
+	uint8_t numerator;
+	uint8_t denominator;
+	int64_t bar;
+};
+
+// Standard MIDI File reader and writer for the offline tools. All tracks are
+// merged into one list of channel messages in tick order. Tempo and time
+// signature changes are kept apart, to convert between ticks, seconds and the
+// bar/beat position a host would report.
+class MidiFile {
+public:
+	MidiFile();
+	~MidiFile();
+	bool load(const char* path);
+	bool save(const char* path) const;
+	void copyTimeline(const MidiFile& other);
+	void addEvent(uint64_t tick, const uint8_t* data, uint8_t size);
+	uint16_t getDivision() const;
+	const std::vector<MidiFileEvent>& getEvents() const;
+	double getSeconds(uint64_t tick) const;
+	double getTicks(double seconds) const;
+	double getBpm(double seconds) const;
+	void getBarBeat(double seconds, int64_t& bar, double& barBeat, uint8_t& beatsPerBar, uint8_t& beatType) const;
+private:
+	bool parseTrack(const uint8_t* data, uint32_t size);
+	void addTempo(uint64_t tick, uint32_t microsPerQuarter);
+	void addTimeSignature(uint64_t tick, uint8_t numerator, uint8_t denominator);
+	void updateTimeline();
+	double getQuarterTicks() const;
+	const MidiFileTempo& getTempoAtSeconds(double seconds) const;
+
+	uint16_t division;
+	double smpteTicksPerSecond;
+	std::vector<MidiFileEvent> events;
+	std::vector<MidiFileTempo> tempos;
+	std::vector<MidiFileTimeSignature> timeSignatures;
+};
+
+#endif //_H_MIDI_FILE_
@@ -0,0 +1,228 @@
+#include "arpeggiator.hpp"
+
+#include <cstdio>
+#include <vector>
+
+#define OUTPUT_CHECK_SAMPLE_RATE 48000.f
+#define OUTPUT_CHECK_BPM 120.0
+#define OUTPUT_CHECK_BLOCK_SIZE 256
+#define OUTPUT_CHECK_PLAY_FRAMES 96000
+#define OUTPUT_CHECK_TOTAL_FRAMES 120000
+
+// a sink with room for a fixed number of events, like a host buffer
+class FixedSink : public MidiEventSink {
+public:
+	FixedSink(uint32_t capacity, bool reportsSpace) :
+		capacity(capacity),
+		reportsSpace(reportsSpace),
+		numNoteOns(0),
+		numNoteOffs(0)
+	{
+	}
+
+	bool writeEvent(const MidiEvent& event) override
+	{
+		if (numNoteOns + numNoteOffs >= capacity) {
+			return false;
+		}
+		if ((event.data[0] & 0xF0) == MIDI_NOTEON) {
+			numNoteOns++;
+		} else {
+			numNoteOffs++;
+		}
+		return true;
+	}
+
+	uint32_t getFreeEvents() const override
+	{
+		return reportsSpace ? capacity - numNoteOns - numNoteOffs : UINT32_MAX;
+	}
+
+	uint32_t capacity;
+	bool reportsSpace;
+	uint32_t numNoteOns;
+	uint32_t numNoteOffs;
+};
+
+static void appendNote(MidiHandler& handler, uint8_t status, uint8_t note)
+{
+	MidiEvent event;
+	event.frame = 0;
+	event.size = 3;
+	event.data[0] = status;
+	event.data[1] = note;
+	event.data[2] = (status == MIDI_NOTEON) ? 100 : 0;
+	event.data[3] = 0;
+	event.dataExt = nullptr;
+
+	handler.appendMidiMessage(event);
+}
+
+// a burst of note-ons and then their note-offs in one block, the note-ons
+// that do not fit are dropped and every note-off is still written
+static bool checkReserve(const char* name, uint32_t capacity, bool reportsSpace, uint32_t numNotes, uint32_t numNoteOffs)
+{
+	FixedSink sink(capacity, reportsSpace);
+	MidiHandler handler;
+	handler.setSink(&sink);
+	handler.nextBlock();
+
+	for (uint32_t n = 0; n < numNotes; n++) {
+		appendNote(handler, MIDI_NOTEON, static_cast<uint8_t>(n % 128));
+	}
+	for (uint32_t n = 0; n < numNoteOffs; n++) {
+		appendNote(handler, MIDI_NOTEOFF, static_cast<uint8_t>(n % 128));
+	}
+
+	const uint32_t room = (capacity < MIDI_OUTPUT_CAPACITY) ? capacity : MIDI_OUTPUT_CAPACITY;
+	const uint32_t expectedNoteOns = room - MIDI_NOTE_OFF_RESERVE;
+
+	if (sink.numNoteOns != expectedNoteOns || sink.numNoteOffs != numNoteOffs
+			|| handler.getDroppedEvents() != numNotes - expectedNoteOns || handler.getDroppedNoteOffs() != 0) {
+		printf("FAIL %s: %u note-ons and %u note-offs written, %u dropped, %u of them note-offs, expected %u and %u\n",
+				name, sink.numNoteOns, sink.numNoteOffs, handler.getDroppedEvents(), handler.getDroppedNoteOffs(),
+				expectedNoteOns, numNoteOffs);
+		return false;
+	}
+
+	return true;
+}
+
+// keeps the realtime messages the arpeggiator writes, on the frame of the run
+class ClockSink : public MidiEventSink {
+public:
+	ClockSink() : blockStart(0) {}
+
+	bool writeEvent(const MidiEvent& event) override
+	{
+		if (event.data[0] >= MIDI_TIMING_CLOCK) {
+			events.push_back(std::make_pair(blockStart + event.frame, event.data[0]));
+		}
+		return true;
+	}
+
+	uint64_t blockStart;
+	std::vector<std::pair<uint64_t, uint8_t> > events;
+};
+
+// a host in 4/4 playing from the start of the song at a steady tempo
+static TimePosition getPosition(bool playing, uint64_t frame)
+{
+	const double beats = frame / (OUTPUT_CHECK_SAMPLE_RATE * 60.0 / OUTPUT_CHECK_BPM);
+	const int64_t wholeBeats = static_cast<int64_t>(beats);
+
+	TimePosition position;
+	position.playing = playing;
+	position.frame = frame;
+	position.bbt.valid = true;
+	position.bbt.bar = static_cast<int32_t>(wholeBeats / 4 + 1);
+	position.bbt.beat = static_cast<int32_t>(wholeBeats % 4 + 1);
+	position.bbt.barBeat = static_cast<float>(wholeBeats % 4 + (beats - wholeBeats));
+	position.bbt.tick = static_cast<int32_t>((beats - wholeBeats) * 1920.0);
+	position.bbt.beatsPerBar = 4;
+	position.bbt.beatType = 4;
+	position.bbt.ticksPerBeat = 1920.0;
+	position.bbt.beatsPerMinute = OUTPUT_CHECK_BPM;
+
+	return position;
+}
+
+// a note held while the host plays, then released as the host stops. The
+// clock output starts with the note and ticks 24 times a beat, it stops by
+// the block after the one the note ends in. The host sync modes may tick on
+// after the Stop, still on the grid.
+static bool checkClockOutput(int syncMode)
+{
+	const uint64_t tickSpacing = static_cast<uint64_t>(OUTPUT_CHECK_SAMPLE_RATE * 60.0 / (OUTPUT_CHECK_BPM * MIDI_CLOCK_PPQN));
+
+	Arpeggiator arpeggiator;
+	ClockSink sink;
+	arpeggiator.setSampleRate(OUTPUT_CHECK_SAMPLE_RATE);
+	arpeggiator.setBpm(OUTPUT_CHECK_BPM);
+	arpeggiator.setSyncMode(syncMode);
+	arpeggiator.setClockOutput(true);
+	arpeggiator.setEventSink(&sink);
+
+	for (uint64_t blockStart = 0; blockStart < OUTPUT_CHECK_TOTAL_FRAMES; blockStart += OUTPUT_CHECK_BLOCK_SIZE) {
+		MidiEvent note;
+		note.frame = 0;
+		note.size = 3;
+		note.data[0] = (blockStart < OUTPUT_CHECK_PLAY_FRAMES) ? MIDI_NOTEON : MIDI_NOTEOFF;
+		note.data[1] = 60;
+		note.data[2] = (blockStart < OUTPUT_CHECK_PLAY_FRAMES) ? 100 : 0;
+		note.data[3] = 0;
+		note.dataExt = nullptr;
+		const bool sendNote = blockStart == 0 || blockStart == OUTPUT_CHECK_PLAY_FRAMES;
+
+		sink.blockStart = blockStart;
+		arpeggiator.transmitHostInfo(getPosition(blockStart < OUTPUT_CHECK_PLAY_FRAMES, blockStart));
+		arpeggiator.process(&note, sendNote ? 1 : 0, OUTPUT_CHECK_BLOCK_SIZE);
+	}
+
+	const std::vector<std::pair<uint64_t, uint8_t> >& events = sink.events;
+	const char* problem = nullptr;
+	uint64_t numTicks = 0;
+	uint64_t stopFrame = UINT64_MAX;
+	unsigned e = 0;
+
+	if (events.empty() || events[0].second != MIDI_START || events[0].first != 0) {
+		problem = "no Start on the first frame";
+	}
+
+	for (e = 1; problem == nullptr && e < events.size(); e++) {
+		const uint64_t frame = events[e].first;
+
+		if (events[e].second == MIDI_TIMING_CLOCK) {
+			if (frame != numTicks * tickSpacing) {
+				problem = "a tick off the grid";
+			}
+			numTicks++;
+		} else if (events[e].second == MIDI_STOP && stopFrame == UINT64_MAX) {
+			stopFrame = frame;
+			if (frame < OUTPUT_CHECK_PLAY_FRAMES || frame >= OUTPUT_CHECK_PLAY_FRAMES + 2 * OUTPUT_CHECK_BLOCK_SIZE) {
+				problem = "a Stop away from the end of the note";
+			} else if (numTicks * tickSpacing < frame) {
+				problem = "ticks missing before the Stop";
+			}
+		} else {
+			problem = "an unexpected message";
+		}
+	}
+
+	if (problem == nullptr && stopFrame == UINT64_MAX) {
+		problem = "no Stop";
+	}
+
+	if (problem != nullptr) {
+		const unsigned last = (e > 0) ? e - 1 : 0;
+		printf("FAIL clock output in sync mode %d: %s, 0x%02X at frame %llu\n", syncMode, problem,
+				(last < events.size()) ? events[last].second : 0,
+				static_cast<unsigned long long>((last < events.size()) ? events[last].first : 0));
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	unsigned checks = 0;
+	unsigned failures = 0;
+
+	// a host buffer smaller than the handler's own bound
+	failures += checkReserve("small sink", 300, true, 400, 100) ? 0 : 1;
+	checks++;
+
+	// a sink with no bound of its own, the handler's bound applies
+	failures += checkReserve("handler bound", UINT32_MAX, false, 3000, MIDI_NOTE_OFF_RESERVE) ? 0 : 1;
+	checks++;
+
+	for (int syncMode = FREE_RUNNING; syncMode <= HOST_QUANTIZED_SYNC; syncMode++) {
+		failures += checkClockOutput(syncMode) ? 0 : 1;
+		checks++;
+	}
+
+	printf("%u of %u output checks passed\n", checks - failures, checks);
+
+	return (failures == 0) ? 0 : 1;
+}
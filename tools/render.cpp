@@ -0,0 +1,618 @@
+#include "arpeggiator.hpp"
+#include "midiFile.hpp"
+#ifdef CLOCK_INSTRUMENTATION
+#include "jitterReport.hpp"
+#endif
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <vector>
+
+#define RENDER_DEFAULT_SAMPLE_RATE 48000
+#define RENDER_DEFAULT_BLOCK_SIZE 256
+#define RENDER_DEFAULT_TAIL 2.0
+#define RENDER_MAX_INPUT_EVENTS 2048
+#define RENDER_TICKS_PER_BEAT 1920.0
+
+typedef std::chrono::steady_clock RenderClock;
+
+// what a host reports at the start of a block
+struct TransportState {
+	bool playing;
+	uint64_t frame;
+	double bpm;
+	uint8_t beatsPerBar;
+	uint8_t beatType;
+	int64_t bar;
+	double barBeat;
+};
+
+// a recorded host transport, one line per change
+struct TransportSnapshot {
+	uint64_t frame;
+	TransportState state;
+};
+
+enum TransportSource {
+	TRANSPORT_FILE = 0,
+	TRANSPORT_STOPPED,
+	TRANSPORT_RECORDED
+};
+
+struct RenderParameter {
+	const char* symbol;
+	float value;
+};
+
+// same symbols and defaults as the plugin ports, enabled is on since there is no host to switch it
+static RenderParameter renderParameters[] = {
+	{"sync", 1.f},
+	{"Bpm", 120.f},
+	{"Divisions", 9.f},
+	{"velocity", 110.f},
+	{"noteLength", 0.7f},
+	{"octaveSpread", 1.f},
+	{"arpMode", 0.f},
+	{"octaveMode", 4.f},
+	{"latch", 0.f},
+	{"enabled", 1.f},
+	{"seed", 0.f},
+	{"clockOutput", 0.f},
+	{"swing", 50.f},
+	{"groove", 0.f},
+	{"restart", 0.f},
+	{"firstNote", 0.f},
+	{"chordWindow", 20.f}
+};
+
+#define NUM_RENDER_PARAMETERS (sizeof(renderParameters) / sizeof(renderParameters[0]))
+
+static void usage(const char* program)
+{
+	fprintf(stderr,
+		"usage: %s [options] input.mid output.mid\n"
+		"\n"
+		"Runs a MIDI file through the arpeggiator without a host and writes what it plays.\n"
+		"\n"
+		"  -r, --sample-rate HZ       sample rate to run at (%d)\n"
+		"  -b, --block-size FRAMES    frames per process() call (%d)\n"
+		"  -t, --transport SOURCE     host transport: 'file' follows the tempo map and time\n"
+		"                             signature of the input (default), 'stopped' never plays,\n"
+		"                             anything else is read as a recorded transport log\n"
+		"  -p, --param SYMBOL=VALUE   set a plugin port, can be given more than once\n"
+		"  -g, --groove STEPS         a groove of its own instead of the groove port, as\n"
+		"                             OFFSET:GATE per step separated by commas, offsets in\n"
+		"                             steps and gates scaling the note length, 2 to %d steps\n"
+		"  -l, --tail SECONDS         keep running after the last input event (%.1f)\n"
+		"  -q, --quiet                do not print the summary\n"
+		"\n"
+		"A recorded transport log has one line per change, '#' starts a comment:\n"
+		"  frame playing bpm beatsPerBar barBeat\n"
+		"The position runs on from each line at its tempo while playing, every line is\n"
+		"reported as a relocation of the host.\n"
+		"\n"
+		"Ports: sync Bpm Divisions velocity noteLength octaveSpread arpMode octaveMode latch enabled seed\n"
+		"       clockOutput swing groove restart firstNote chordWindow\n"
+		"\n"
+		"MIDI clock output has no place in a MIDI file, it is counted in the summary instead.\n",
+		program, RENDER_DEFAULT_SAMPLE_RATE, RENDER_DEFAULT_BLOCK_SIZE, GROOVE_MAX_STEPS, RENDER_DEFAULT_TAIL);
+}
+
+static bool setParameter(const char* assignment)
+{
+	const char* separator = strchr(assignment, '=');
+
+	if (separator == nullptr) {
+		fprintf(stderr, "expected SYMBOL=VALUE, got '%s'\n", assignment);
+		return false;
+	}
+
+	for (unsigned p = 0; p < NUM_RENDER_PARAMETERS; p++) {
+		if (strlen(renderParameters[p].symbol) == static_cast<size_t>(separator - assignment)
+				&& strncmp(renderParameters[p].symbol, assignment, separator - assignment) == 0) {
+			renderParameters[p].value = static_cast<float>(atof(separator + 1));
+			return true;
+		}
+	}
+
+	fprintf(stderr, "unknown port '%.*s'\n", static_cast<int>(separator - assignment), assignment);
+	return false;
+}
+
+static float getParameter(const char* symbol)
+{
+	for (unsigned p = 0; p < NUM_RENDER_PARAMETERS; p++) {
+		if (strcmp(renderParameters[p].symbol, symbol) == 0) {
+			return renderParameters[p].value;
+		}
+	}
+
+	return 0.f;
+}
+
+// in the same order the plugin gets them from the host on instantiation
+static void applyParameters(Arpeggiator& arpeggiator)
+{
+	arpeggiator.setSyncMode(static_cast<int>(getParameter("sync")));
+	arpeggiator.setBpm(getParameter("Bpm"));
+	arpeggiator.setDivision(static_cast<int>(getParameter("Divisions")));
+	arpeggiator.setVelocity(static_cast<int>(getParameter("velocity")));
+	arpeggiator.setNoteLength(getParameter("noteLength"));
+	arpeggiator.setOctaveSpread(static_cast<int>(getParameter("octaveSpread")));
+	arpeggiator.setArpMode(static_cast<int>(getParameter("arpMode")));
+	arpeggiator.setOctaveMode(static_cast<int>(getParameter("octaveMode")));
+	arpeggiator.setLatchMode(static_cast<bool>(getParameter("latch")));
+	arpeggiator.setArpEnabled(static_cast<bool>(getParameter("enabled")));
+	arpeggiator.setSeed(static_cast<int>(getParameter("seed")));
+	arpeggiator.setClockOutput(static_cast<bool>(getParameter("clockOutput")));
+	arpeggiator.setSwing(getParameter("swing"));
+	arpeggiator.setGroove(static_cast<int>(getParameter("groove")));
+	arpeggiator.setRestartMode(static_cast<int>(getParameter("restart")));
+	arpeggiator.setFirstNoteMode(static_cast<int>(getParameter("firstNote")));
+	arpeggiator.setChordWindow(getParameter("chordWindow"));
+}
+
+static bool parseGroove(const char* steps, GrooveTemplate& groove)
+{
+	groove.name = "custom";
+	groove.numSteps = 0;
+
+	const char* step = steps;
+	while (*step != '\0') {
+		char* end;
+		const float offset = strtof(step, &end);
+		if (end == step || *end != ':' || groove.numSteps == GROOVE_MAX_STEPS) {
+			break;
+		}
+		step = end + 1;
+		const float gate = strtof(step, &end);
+		if (end == step || (*end != ',' && *end != '\0')) {
+			break;
+		}
+
+		groove.offsets[groove.numSteps] = offset;
+		groove.gates[groove.numSteps] = gate;
+		groove.numSteps++;
+		step = (*end == ',') ? end + 1 : end;
+	}
+
+	if (*step != '\0' || groove.numSteps < GROOVE_MIN_STEPS) {
+		fprintf(stderr, "expected %d to %d OFFSET:GATE steps, got '%s'\n", GROOVE_MIN_STEPS, GROOVE_MAX_STEPS, steps);
+		return false;
+	}
+
+	return true;
+}
+
+static bool loadTransport(const char* path, double sampleRate, std::vector<TransportSnapshot>& snapshots)
+{
+	FILE* file = fopen(path, "r");
+
+	if (file == nullptr) {
+		fprintf(stderr, "%s: cannot open transport log\n", path);
+		return false;
+	}
+
+	char line[256];
+	unsigned lineNumber = 0;
+
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		lineNumber++;
+
+		char* comment = strchr(line, '#');
+		if (comment != nullptr) {
+			*comment = '\0';
+		}
+
+		unsigned long long frame;
+		int playing;
+		double bpm;
+		unsigned beatsPerBar;
+		double barBeat;
+		const int numFields = sscanf(line, "%llu %d %lf %u %lf", &frame, &playing, &bpm, &beatsPerBar, &barBeat);
+
+		if (numFields <= 0) {
+			continue;
+		}
+		if (numFields != 5 || bpm <= 0.0 || beatsPerBar == 0 || beatsPerBar > 255) {
+			fprintf(stderr, "%s:%u: expected 'frame playing bpm beatsPerBar barBeat'\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+		if (!snapshots.empty() && frame < snapshots.back().frame) {
+			fprintf(stderr, "%s:%u: frames must not go back\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+
+		TransportSnapshot snapshot;
+		snapshot.frame = frame;
+		snapshot.state.playing = (playing != 0);
+		snapshot.state.frame = static_cast<uint64_t>(llround(barBeat * 60.0 / bpm * sampleRate));
+		snapshot.state.bpm = bpm;
+		snapshot.state.beatsPerBar = static_cast<uint8_t>(beatsPerBar);
+		snapshot.state.beatType = 4;
+		snapshot.state.bar = 0;
+		snapshot.state.barBeat = barBeat;
+
+		snapshots.push_back(snapshot);
+	}
+
+	fclose(file);
+
+	if (snapshots.empty()) {
+		fprintf(stderr, "%s: transport log is empty\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+static TransportState getFileTransport(const MidiFile& input, double seconds, double sampleRate)
+{
+	TransportState state;
+
+	state.playing = true;
+	state.frame = static_cast<uint64_t>(llround(seconds * sampleRate));
+	input.getBarBeat(seconds, state.bar, state.barBeat, state.beatsPerBar, state.beatType);
+	state.bpm = input.getBpm(seconds) * state.beatType / 4.0;
+
+	return state;
+}
+
+// the last snapshot at or before the frame, with the position carried on while playing
+static TransportState getRecordedTransport(const std::vector<TransportSnapshot>& snapshots, size_t& current, uint64_t frame, double sampleRate)
+{
+	while (current + 1 < snapshots.size() && snapshots[current + 1].frame <= frame) {
+		current++;
+	}
+
+	const TransportSnapshot& snapshot = snapshots[current];
+	TransportState state = snapshot.state;
+
+	if (state.playing && frame > snapshot.frame) {
+		state.frame += frame - snapshot.frame;
+		const double beats = state.barBeat + (frame - snapshot.frame) / sampleRate * state.bpm / 60.0;
+		const double bars = floor(beats / state.beatsPerBar);
+		state.bar += static_cast<int64_t>(bars);
+		state.barBeat = beats - bars * state.beatsPerBar;
+	}
+
+	return state;
+}
+
+static TimePosition getTimePosition(const TransportState& state)
+{
+	const double wholeBeats = floor(state.barBeat);
+
+	TimePosition position;
+	position.playing = state.playing;
+	position.frame = state.frame;
+	position.bbt.valid = true;
+	position.bbt.bar = static_cast<int32_t>(state.bar + 1);
+	position.bbt.beat = static_cast<int32_t>(wholeBeats) + 1;
+	position.bbt.barBeat = static_cast<float>(state.barBeat);
+	position.bbt.tick = static_cast<int32_t>((state.barBeat - wholeBeats) * RENDER_TICKS_PER_BEAT);
+	position.bbt.beatsPerBar = state.beatsPerBar;
+	position.bbt.beatType = state.beatType;
+	position.bbt.ticksPerBeat = RENDER_TICKS_PER_BEAT;
+	position.bbt.beatsPerMinute = state.bpm;
+
+	return position;
+}
+
+// what the clock output sent, a file cannot hold it
+struct ClockOutputSummary {
+	uint64_t numTicks;
+	uint64_t minSpacing;
+	uint64_t maxSpacing;
+	uint32_t numStarts;
+	uint32_t numContinues;
+	uint32_t numStops;
+};
+
+// puts the output in the file as it is made, on the tick its frame falls on
+class RenderSink : public MidiEventSink {
+public:
+	RenderSink(const MidiFile& input, MidiFile& output, double sampleRate) :
+		input(input),
+		output(output),
+		sampleRate(sampleRate),
+		blockStart(0),
+		numEvents(0),
+		lastTickFrame(UINT64_MAX),
+		clockOutput()
+	{
+		clockOutput.minSpacing = UINT64_MAX;
+	}
+
+	void setBlockStart(uint64_t blockStart)
+	{
+		this->blockStart = blockStart;
+	}
+
+	uint64_t getNumEvents() const
+	{
+		return numEvents;
+	}
+
+	const ClockOutputSummary& getClockOutput() const
+	{
+		return clockOutput;
+	}
+
+	bool writeEvent(const MidiEvent& event) override
+	{
+		numEvents++;
+
+		if (event.data[0] >= MIDI_SYSTEM_EXCLUSIVE) {
+			addClockOutput(event);
+			return true;
+		}
+
+		const double seconds = (blockStart + event.frame) / sampleRate;
+		const uint8_t size = static_cast<uint8_t>(std::min<uint32_t>(event.size, 3));
+		output.addEvent(static_cast<uint64_t>(llround(input.getTicks(seconds))), event.data, size);
+
+		return true;
+	}
+
+private:
+	// the spacing of the ticks is only measured while the clock runs
+	void addClockOutput(const MidiEvent& event)
+	{
+		const uint64_t frame = blockStart + event.frame;
+
+		switch (event.data[0])
+		{
+			case MIDI_TIMING_CLOCK:
+				if (lastTickFrame != UINT64_MAX) {
+					clockOutput.minSpacing = std::min(clockOutput.minSpacing, frame - lastTickFrame);
+					clockOutput.maxSpacing = std::max(clockOutput.maxSpacing, frame - lastTickFrame);
+				}
+				clockOutput.numTicks++;
+				lastTickFrame = frame;
+				break;
+			case MIDI_START:
+				clockOutput.numStarts++;
+				lastTickFrame = UINT64_MAX;
+				break;
+			case MIDI_CONTINUE:
+				clockOutput.numContinues++;
+				lastTickFrame = UINT64_MAX;
+				break;
+			case MIDI_STOP:
+				clockOutput.numStops++;
+				lastTickFrame = UINT64_MAX;
+				break;
+		}
+	}
+
+	const MidiFile& input;
+	MidiFile& output;
+	double sampleRate;
+	uint64_t blockStart;
+	uint64_t numEvents;
+	uint64_t lastTickFrame;
+	ClockOutputSummary clockOutput;
+};
+
+int main(int argc, char** argv)
+{
+	static const struct option longOptions[] = {
+		{"sample-rate", required_argument, nullptr, 'r'},
+		{"block-size", required_argument, nullptr, 'b'},
+		{"transport", required_argument, nullptr, 't'},
+		{"param", required_argument, nullptr, 'p'},
+		{"groove", required_argument, nullptr, 'g'},
+		{"tail", required_argument, nullptr, 'l'},
+		{"quiet", no_argument, nullptr, 'q'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+
+	double sampleRate = RENDER_DEFAULT_SAMPLE_RATE;
+	long blockSize = RENDER_DEFAULT_BLOCK_SIZE;
+	double tail = RENDER_DEFAULT_TAIL;
+	const char* transportPath = nullptr;
+	TransportSource transportSource = TRANSPORT_FILE;
+	bool quiet = false;
+	bool customGroove = false;
+	GrooveTemplate groove;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "r:b:t:p:g:l:qh", longOptions, nullptr)) != -1) {
+		switch (option)
+		{
+			case 'r':
+				sampleRate = atof(optarg);
+				break;
+			case 'b':
+				blockSize = atol(optarg);
+				break;
+			case 't':
+				if (strcmp(optarg, "file") == 0) {
+					transportSource = TRANSPORT_FILE;
+				} else if (strcmp(optarg, "stopped") == 0) {
+					transportSource = TRANSPORT_STOPPED;
+				} else {
+					transportSource = TRANSPORT_RECORDED;
+					transportPath = optarg;
+				}
+				break;
+			case 'p':
+				if (!setParameter(optarg)) {
+					return 1;
+				}
+				break;
+			case 'g':
+				if (!parseGroove(optarg, groove)) {
+					return 1;
+				}
+				customGroove = true;
+				break;
+			case 'l':
+				tail = atof(optarg);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			default:
+				usage(argv[0]);
+				return (option == 'h') ? 0 : 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (sampleRate < 1000.0 || blockSize < 1 || blockSize > 1 << 20 || tail < 0.0) {
+		fprintf(stderr, "sample rate, block size or tail out of range\n");
+		return 1;
+	}
+
+	MidiFile input;
+	if (!input.load(argv[optind])) {
+		return 1;
+	}
+
+	std::vector<TransportSnapshot> snapshots;
+	if (transportSource == TRANSPORT_RECORDED && !loadTransport(transportPath, sampleRate, snapshots)) {
+		return 1;
+	}
+
+	// input positions in frames, the same rounding a host applies to a timeline
+	const std::vector<MidiFileEvent>& inputEvents = input.getEvents();
+	std::vector<uint64_t> inputFrames(inputEvents.size());
+
+	for (size_t e = 0; e < inputEvents.size(); e++) {
+		inputFrames[e] = static_cast<uint64_t>(llround(input.getSeconds(inputEvents[e].tick) * sampleRate));
+	}
+
+	const uint64_t lastFrame = inputFrames.empty() ? 0 : inputFrames.back();
+	const uint64_t totalFrames = lastFrame + static_cast<uint64_t>(tail * sampleRate) + 1;
+
+	MidiFile output;
+	output.copyTimeline(input);
+	RenderSink sink(input, output, sampleRate);
+
+	Arpeggiator* arpeggiator = new Arpeggiator();
+	arpeggiator->setSampleRate(static_cast<float>(sampleRate));
+	arpeggiator->setEventSink(&sink);
+	applyParameters(*arpeggiator);
+	if (customGroove) {
+		arpeggiator->setGrooveTemplate(groove);
+	}
+
+#ifdef CLOCK_INSTRUMENTATION
+	// read out after every block, as a host's non realtime thread would
+	GateLog* gateLog = new GateLog();
+	JitterReport jitterReport(sampleRate, totalFrames);
+	arpeggiator->setGateLog(gateLog);
+#endif
+
+	std::vector<MidiEvent> blockEvents(RENDER_MAX_INPUT_EVENTS);
+	size_t nextInput = 0;
+	size_t currentSnapshot = 0;
+	uint64_t numBlocks = 0;
+	uint64_t numDroppedInputs = 0;
+
+	const RenderClock::time_point start = RenderClock::now();
+
+	for (uint64_t blockStart = 0; blockStart < totalFrames; blockStart += blockSize) {
+		const uint32_t numFrames = static_cast<uint32_t>(std::min<uint64_t>(blockSize, totalFrames - blockStart));
+		uint32_t numEvents = 0;
+
+		while (nextInput < inputEvents.size() && inputFrames[nextInput] < blockStart + numFrames) {
+			if (numEvents < RENDER_MAX_INPUT_EVENTS) {
+				MidiEvent& event = blockEvents[numEvents++];
+				event.frame = static_cast<uint32_t>(inputFrames[nextInput] - blockStart);
+				event.size = inputEvents[nextInput].size;
+				memcpy(event.data, inputEvents[nextInput].data, 3);
+				event.data[3] = 0;
+				event.dataExt = nullptr;
+			} else {
+				numDroppedInputs++;
+			}
+			nextInput++;
+		}
+
+		TransportState transport;
+		switch (transportSource)
+		{
+			case TRANSPORT_FILE:
+				transport = getFileTransport(input, blockStart / sampleRate, sampleRate);
+				break;
+			case TRANSPORT_STOPPED:
+				transport = getFileTransport(input, 0.0, sampleRate);
+				transport.playing = false;
+				break;
+			case TRANSPORT_RECORDED:
+				transport = getRecordedTransport(snapshots, currentSnapshot, blockStart, sampleRate);
+				break;
+		}
+
+		sink.setBlockStart(blockStart);
+		arpeggiator->transmitHostInfo(getTimePosition(transport));
+		arpeggiator->process(blockEvents.data(), numEvents, numFrames);
+
+#ifdef CLOCK_INSTRUMENTATION
+		GateRecord record;
+		while (gateLog->pop(record)) {
+			jitterReport.add(record);
+		}
+#endif
+
+		numBlocks++;
+	}
+
+	const double elapsed = std::chrono::duration<double>(RenderClock::now() - start).count();
+	const uint32_t numDroppedOutputs = arpeggiator->getDroppedEvents();
+	const uint32_t numDroppedNoteOffs = arpeggiator->getDroppedNoteOffs();
+	delete arpeggiator;
+
+	if (!output.save(argv[optind + 1])) {
+		return 1;
+	}
+
+	if (!quiet) {
+		const double renderedSeconds = totalFrames / sampleRate;
+		fprintf(stderr, "rendered %.1f s in %llu blocks of %ld frames at %.0f Hz\n",
+				renderedSeconds, static_cast<unsigned long long>(numBlocks), blockSize, sampleRate);
+		fprintf(stderr, "%zu events in, %llu events out\n",
+				inputEvents.size(), static_cast<unsigned long long>(sink.getNumEvents()));
+		fprintf(stderr, "%.3f s, %.0fx realtime\n", elapsed, (elapsed > 0.0) ? renderedSeconds / elapsed : 0.0);
+
+		const ClockOutputSummary& clockOutput = sink.getClockOutput();
+		if (clockOutput.numTicks > 0 || clockOutput.numStops > 0) {
+			fprintf(stderr, "clock out: %llu ticks, %llu to %llu frames apart, %u starts, %u continues, %u stops\n",
+					static_cast<unsigned long long>(clockOutput.numTicks),
+					static_cast<unsigned long long>((clockOutput.minSpacing != UINT64_MAX) ? clockOutput.minSpacing : 0),
+					static_cast<unsigned long long>(clockOutput.maxSpacing),
+					clockOutput.numStarts, clockOutput.numContinues, clockOutput.numStops);
+		}
+	}
+	if (numDroppedInputs > 0) {
+		fprintf(stderr, "warning: %llu input events over %d per block were dropped\n",
+				static_cast<unsigned long long>(numDroppedInputs), RENDER_MAX_INPUT_EVENTS);
+	}
+	if (numDroppedOutputs > 0) {
+		fprintf(stderr, "warning: %u output events over %d per block were dropped, %u of them note-offs\n",
+				numDroppedOutputs, MIDI_OUTPUT_CAPACITY, numDroppedNoteOffs);
+	}
+
+#ifdef CLOCK_INSTRUMENTATION
+	jitterReport.print(stdout);
+	if (gateLog->getDropped() > 0) {
+		fprintf(stderr, "warning: %u gates did not fit the gate log\n", gateLog->getDropped());
+	}
+	delete gateLog;
+#endif
+
+	return 0;
+}